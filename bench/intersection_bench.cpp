@@ -0,0 +1,122 @@
+#include "linearAlgebra.h"
+#include "shapes.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <optional>
+#include <iostream>
+#include <iomanip>
+
+/*
+	Each test pairs one ray with one sphere. A fraction of the rays, the hit rate, are aimed
+	inside the sphere's silhouette and the rest just outside it, so the branch in each kernel
+	sees a controlled mix of outcomes.
+*/
+struct IntersectionBatch {
+	std::vector<pt3> origins;
+	std::vector<vec3> directions;
+	std::vector<shapes::Sphere> spheres;
+};
+
+auto make_batch(const size_t& size, const float& hit_rate) -> IntersectionBatch {
+	IntersectionBatch batch;
+	batch.origins.reserve(size);
+	batch.directions.reserve(size);
+	batch.spheres.reserve(size);
+
+	std::mt19937 rand_engine{ 7 };
+	std::uniform_real_distribution<float> get_unit(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> get_chance(0.0f, 1.0f);
+	std::uniform_real_distribution<float> get_radius(0.1f, 2.0f);
+	std::uniform_real_distribution<float> get_distance(5.0f, 50.0f);
+
+	for (size_t i = 0; i < size; ++i) {
+		const auto origin = pt3{ get_unit(rand_engine), get_unit(rand_engine), get_unit(rand_engine) };
+		const auto to_centre = uvec_to_vec(uvec3{ get_unit(rand_engine), get_unit(rand_engine), get_unit(rand_engine) });
+		const auto distance = Real(get_distance(rand_engine));
+		const auto radius = Real(get_radius(rand_engine));
+		const auto centre = pt_from_ray(origin, to_centre, distance);
+
+		// Offset the aim point perpendicular to the centre direction so the ray passes the centre at miss_distance.
+		const auto side = uvec_to_vec(normalise(cross_product(to_centre, vec3{ get_unit(rand_engine), get_unit(rand_engine), 1.0f })));
+		const auto miss_distance = (get_chance(rand_engine) < hit_rate)
+			? radius * 0.9f * get_chance(rand_engine)
+			: radius * (1.1f + 0.9f * get_chance(rand_engine));
+		const auto offset = miss_distance * distance / sqrt(distance * distance - miss_distance * miss_distance);
+		const auto aim = pt_from_ray(centre, side, offset);
+
+		batch.origins.push_back(origin);
+		batch.directions.push_back(vec_from_pts(aim, origin));
+		batch.spheres.emplace_back(centre, radius);
+	}
+	return batch;
+}
+
+struct KernelResult {
+	double ns_per_test;
+	size_t hits;
+};
+
+auto time_kernel(const IntersectionBatch& batch, const size_t& reps, const auto& kernel) -> KernelResult {
+	std::vector<double> ns_per_test;
+	size_t hits = 0;
+	for (size_t rep = 0; rep <= reps; ++rep) {
+		hits = 0;
+		const auto time_start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < batch.spheres.size(); ++i) {
+			hits += kernel(batch.spheres[i], batch.origins[i], batch.directions[i]);
+		}
+		const auto time_end = std::chrono::steady_clock::now();
+		if (rep > 0) {
+			ns_per_test.push_back(std::chrono::duration<double, std::nano>{ time_end - time_start }.count() / batch.spheres.size());
+		}
+	}
+	std::sort(ns_per_test.begin(), ns_per_test.end());
+	return KernelResult{ ns_per_test[ns_per_test.size() / 2], hits };
+}
+
+auto get_option(int argc, char* argv[], std::string_view name) -> std::optional<std::string_view> {
+	for (int i = 1; i + 1 < argc; i++) {
+		if (argv[i] == name) {
+			return argv[i + 1];
+		}
+	}
+	return {};
+}
+
+int main(int argc, char* argv[])
+{
+	const auto size = std::stoul(std::string(get_option(argc, argv, "--size").value_or("1000000")));
+	const auto reps = std::stoul(std::string(get_option(argc, argv, "--reps").value_or("5")));
+	if (reps < 1) {
+		std::cout << "ERROR:\t--reps expects at least 1 but got " << reps << "\n";
+		return 1;
+	}
+	constexpr auto HIT_RATES = std::array{ 0.0f, 0.1f, 0.5f, 0.9f, 1.0f };
+
+	const auto hit_pt = [](const auto& s, const auto& o, const auto& d) -> size_t { return shapes::get_hit_pt(s, o, d).has_value(); };
+	const auto hit_t = [](const auto& s, const auto& o, const auto& d) -> size_t { return shapes::get_hit_t(s, o, d).has_value(); };
+	const auto hit_tt = [](const auto& s, const auto& o, const auto& d) -> size_t { return shapes::get_hit_tt(s, o, d).has_value(); };
+
+	std::cout << "intersection_bench: " << size << " ray/sphere pairs, median of " << reps << " reps after 1 warm-up\n";
+	std::cout << std::left << std::setw(10) << "hit rate" << std::setw(14) << "kernel"
+		<< std::right << std::setw(10) << "ns/test" << std::setw(14) << "Mtests/s" << std::setw(12) << "hits\n";
+
+	for (const auto& hit_rate : HIT_RATES) {
+		const auto batch = make_batch(size, hit_rate);
+		const auto print_row = [&](std::string_view name, const KernelResult& result) {
+			std::cout << std::left << std::setw(10) << hit_rate << std::setw(14) << name << std::right
+				<< std::fixed << std::setprecision(3) << std::setw(10) << result.ns_per_test
+				<< std::setw(14) << 1e3 / result.ns_per_test
+				<< std::setw(11) << result.hits << "\n" << std::defaultfloat;
+		};
+		print_row("get_hit_pt", time_kernel(batch, reps, hit_pt));
+		print_row("get_hit_t", time_kernel(batch, reps, hit_t));
+		print_row("get_hit_tt", time_kernel(batch, reps, hit_tt));
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+#include "linearAlgebra.h"
+#include "raytracer.h"
+#include "shapes.h"
+#include "scenes.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+struct Measurement {
+	double median;
+	double min;
+	double max;
+};
+
+auto measure(std::vector<double> values) -> Measurement {
+	std::sort(values.begin(), values.end());
+	const auto middle = values.size() / 2;
+	const auto median = (values.size() % 2 == 1) ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+	return Measurement{ median, values.front(), values.back() };
+}
+
+auto print_row(std::string_view metric, const Measurement& m, const double& scale, std::string_view unit) {
+	const auto spread = m.median > 0 ? 100 * (m.max - m.min) / m.median : 0;
+	std::cout << "  " << std::left << std::setw(18) << metric << std::right << std::fixed << std::setprecision(3)
+		<< std::setw(12) << m.median / scale << " " << unit
+		<< "   [" << m.min / scale << " - " << m.max / scale << "]"
+		<< "   spread " << std::setprecision(1) << spread << "%\n";
+}
+
+auto get_option(int argc, char* argv[], std::string_view name) -> std::optional<std::string_view> {
+	for (int i = 1; i + 1 < argc; i++) {
+		if (argv[i] == name) {
+			return argv[i + 1];
+		}
+	}
+	return {};
+}
+
+int main(int argc, char* argv[])
+{
+	const auto reps = std::stoul(std::string(get_option(argc, argv, "--reps").value_or("5")));
+	if (reps < 1) {
+		std::cout << "ERROR:\t--reps expects at least 1 but got " << reps << "\n";
+		return 1;
+	}
+	const auto size = std::stoi(std::string(get_option(argc, argv, "--size").value_or("256")));
+	const auto only_scene = get_option(argc, argv, "--scene");
+	const auto camera = raytracer::Camera{ size, size, degrees_to_radians(90) };
+	raytracer::RenderControl control;
+	control.sort_by_material = std::any_of(argv + 1, argv + argc, [](std::string_view arg) { return arg == "--sort-materials"; });
+	// Picks another compiled kernel, render() reports counts it has none for and uses the defaults.
+	control.ray_depth = std::stoul(std::string(get_option(argc, argv, "--ray-depth").value_or(std::to_string(control.ray_depth))));
+	control.samples_per_pixel = std::stoul(std::string(get_option(argc, argv, "--samples").value_or(std::to_string(control.samples_per_pixel))));
+
+	std::cout << "raytracer_bench: " << size << "x" << size << ", " << reps << " reps after 1 warm-up, ray depth "
+		<< control.ray_depth << ", " << control.samples_per_pixel << " samples per pixel"
+		<< (control.sort_by_material ? ", material sorted shading" : "") << "\n";
+
+	for (const auto& bench : raytracer::scenes::REFERENCE_SCENES) {
+		if (only_scene.has_value() && *only_scene != bench.name) {
+			continue;
+		}
+		const auto objects = bench.make_scene();
+		raytracer::render(camera, objects, control);
+
+		std::vector<double> milliseconds, primary, shadow, total;
+		for (size_t rep = 0; rep < reps; ++rep) {
+			const auto result = raytracer::render(camera, objects, control);
+			const auto seconds = result.render_time.count() / 1000;
+			milliseconds.push_back(result.render_time.count());
+			// Every sample traces one primary ray, so they are known from the frame size.
+			primary.push_back(double(size) * size * control.samples_per_pixel / seconds);
+			shadow.push_back(result.ray_counts.shadow / seconds);
+			total.push_back(result.ray_counts.total() / seconds);
+		}
+
+		std::cout << bench.name << " (" << objects.spheres.size() << " spheres, " << objects.point_lights.size() << " lights)\n";
+		print_row("render time", measure(milliseconds), 1, "ms");
+		print_row("primary rays/s", measure(primary), 1e6, "M");
+		print_row("shadow rays/s", measure(shadow), 1e6, "M");
+		print_row("total rays/s", measure(total), 1e6, "M");
+	}
+	return 0;
+}
@@ -0,0 +1,4 @@
+# Lets other projects use an installed libraytracer with: find_package(raytracer) and raytracer::raytracer
+include(CMakeFindDependencyMacro)
+find_dependency(Threads)
+include(${CMAKE_CURRENT_LIST_DIR}/raytracerTargets.cmake)
@@ -0,0 +1,73 @@
+#ifndef _AOV_H_
+#define _AOV_H_
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <span>
+#include <string>
+#include <string_view>
+#include <optional>
+
+namespace raytracer
+{
+	/*
+		Arbitrary output variables, written alongside the image in the same pass.
+		depth is the distance from the camera to the first hit, infinity where the ray missed.
+		normal is the unit normal and albedo the surface colour in 0 to 1 at the first hit.
+		object_id is the index of the first shape hit, -1 where the ray missed.
+		direct and indirect split the image into light that reached the first diffuse surface
+		straight from the lights and light that bounced first, in 0 to 1 like the image.
+	*/
+	enum class Aov : uint8_t { depth, normal, albedo, object_id, direct, indirect };
+	constexpr size_t AOV_COUNT = 6;
+	constexpr std::array<std::string_view, AOV_COUNT> AOV_NAMES = { "depth", "normal", "albedo", "object_id", "direct", "indirect" };
+
+	constexpr auto get_channel_count(const Aov& aov) -> size_t {
+		return (aov == Aov::depth || aov == Aov::object_id) ? 1 : 3;
+	}
+	constexpr auto parse_aov(std::string_view name) -> std::optional<Aov> {
+		for (size_t i = 0; i < AOV_COUNT; ++i) {
+			if (AOV_NAMES[i] == name) {
+				return Aov(i);
+			}
+		}
+		return {};
+	}
+
+	struct AovSet {
+		uint32_t bits = 0;
+
+		constexpr auto with(const Aov& aov) const { return AovSet{ bits | (1u << uint32_t(aov)) }; }
+		constexpr auto contains(const Aov& aov) const { return (bits & (1u << uint32_t(aov))) != 0; }
+		constexpr auto empty() const { return bits == 0; }
+	};
+
+	// A named plane of floats, the unit the multi-layer writers work in.
+	struct ImageChannel {
+		std::string name;
+		std::span<const float> values;
+	};
+
+	/*
+		One plane of width * height floats per channel of every enabled AOV, so each render thread
+		writes straight into contiguous arrays. Disabled AOVs have empty planes.
+	*/
+	struct AovBuffers {
+		AovSet enabled;
+		size_t width = 0;
+		size_t height = 0;
+		std::array<std::array<std::vector<float>, 3>, AOV_COUNT> planes;
+
+		AovBuffers() = default;
+		AovBuffers(const AovSet& aovs, const size_t& width, const size_t& height);
+		auto plane(const Aov& aov, const size_t& channel) -> std::span<float> { return planes[size_t(aov)][channel]; }
+		auto plane(const Aov& aov, const size_t& channel) const -> std::span<const float> { return planes[size_t(aov)][channel]; }
+		// Channels named like "albedo.R" or "normal.X", with depth as the conventional "Z".
+		auto get_channels() const -> std::vector<ImageChannel>;
+		// The same, for just the enabled AOVs that are also in aovs.
+		auto get_channels(const AovSet& aovs) const -> std::vector<ImageChannel>;
+	};
+}
+
+#endif // _AOV_H_
@@ -0,0 +1,49 @@
+#ifndef _CHECKPOINT_H_
+#define _CHECKPOINT_H_
+
+#include <string>
+#include <cstdint>
+#include <optional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "raytracer.h"
+
+namespace raytracer
+{
+	/*
+		The sampler is reseeded from (seed, pixel, sample count) for every sample,
+		so the seed plus the per-pixel sample counts are the complete sampler state.
+	*/
+	struct Checkpoint {
+		uint32_t width;
+		uint32_t height;
+		uint64_t seed;
+		Accumulator accumulator;
+	};
+
+	auto write_checkpoint(const std::string& path, const Checkpoint& checkpoint) -> bool;
+	auto read_checkpoint(const std::string& path) -> std::optional<Checkpoint>;
+
+	// Writes on its own thread. A newer snapshot replaces one still waiting to be written.
+	class CheckpointWriter {
+		const std::string path_;
+		std::optional<Checkpoint> pending_;
+		bool is_stopping_ = false;
+		std::mutex mutex_;
+		std::condition_variable has_work_;
+		std::thread thread_;
+
+		auto write_loop() -> void;
+	public:
+		CheckpointWriter(const std::string& path);
+		~CheckpointWriter();
+		CheckpointWriter(const CheckpointWriter&) = delete;
+		auto operator=(const CheckpointWriter&) -> CheckpointWriter& = delete;
+
+		auto submit(Checkpoint checkpoint) -> void;
+	};
+}
+
+#endif // _CHECKPOINT_H_
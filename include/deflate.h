@@ -0,0 +1,18 @@
+#ifndef _DEFLATE_H_
+#define _DEFLATE_H_
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace raytracer
+{
+	/*
+		Compresses the bytes as a zlib stream (RFC 1950 around RFC 1951 deflate), readable by any
+		inflate. Matches are found with hash chains in a 32 KiB window and each block gets its own
+		Huffman codes. It favours speed over ratio, like a low zlib level.
+	*/
+	auto zlib_compress(std::span<const uint8_t> data) -> std::vector<uint8_t>;
+}
+
+#endif // _DEFLATE_H_
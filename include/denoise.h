@@ -0,0 +1,44 @@
+#ifndef _DENOISE_H_
+#define _DENOISE_H_
+
+#include <cstddef>
+#include <array>
+#include <span>
+#include <vector>
+
+#include "pixel_formats.h"
+
+namespace raytracer
+{
+	/*
+		Sigmas are the differences at which a neighbour's weight falls to 1/e. The colour sigma
+		applies to the first iteration and halves with each one after it, as the kernel widens.
+	*/
+	struct DenoiseSettings {
+		size_t iterations = 5;
+		float colour_sigma = 0.5f;
+		float normal_sigma = 0.3f;
+		float albedo_sigma = 0.1f;
+	};
+
+	// Three planes of floats, red, green and blue or x, y and z.
+	using PlaneSpans = std::array<std::span<const float>, 3>;
+
+	/*
+		Edge-avoiding a-trous wavelet filter guided by first hit albedo and normals. The colour is
+		divided by the albedo before filtering and multiplied back after, so texture detail survives
+		and only the lighting is smoothed. Each iteration is a 5x5 B3 spline kernel whose taps are
+		twice as far apart as the last, weighted down across colour, normal and albedo edges.
+		All buffers are width * height, colour in 0 to 1. The guides are planar like AovBuffers,
+		so the albedo and normal AOVs are used as they are. Rows are split between threads.
+	*/
+	auto denoise(
+		std::span<const RGBf> colour,
+		const PlaneSpans& albedo,
+		const PlaneSpans& normal,
+		const size_t& width,
+		const size_t& height,
+		const DenoiseSettings& settings = {}) -> std::vector<RGBf>;
+}
+
+#endif // _DENOISE_H_
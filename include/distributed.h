@@ -0,0 +1,41 @@
+#ifndef _DISTRIBUTED_H_
+#define _DISTRIBUTED_H_
+
+#include <string>
+#include <chrono>
+#include <vector>
+#include <span>
+
+#include "raytracer.h"
+#include "scenes.h"
+
+/*
+	Coordinator and worker processes talking over a Unix domain socket.
+	The coordinator owns the tile queue and the output image, workers build the scene from the
+	description they are sent and render whatever tile they are sent. Tiles held by a worker that disconnects or stops
+	answering go back on the queue. When every worker is gone the coordinator renders the tiles
+	that are left itself.
+*/
+namespace raytracer::distributed
+{
+	struct CoordinatorSettings {
+		std::string socket_path;
+		size_t tiles_in_flight_per_worker = 2;
+		std::chrono::milliseconds tile_timeout{ 30000 };
+		size_t spawn_local_workers = 0;
+		// Started with --worker PATH for each local worker, found on the PATH like argv[0]. Empty uses /proc/self/exe on Linux.
+		std::string worker_executable;
+		// Sent to the workers to build their scene from, it has to describe the scene given to run_coordinator.
+		scenes::SceneDescription scene;
+	};
+
+	// The scene renders whatever tiles are left when every worker is gone.
+	auto run_coordinator(const Camera& camera, const Scene& scene, const CoordinatorSettings& settings, const RenderControl& control = {}) -> RenderResult;
+	// Writes the finished tiles into the caller's frame sized buffer, in any framebuffer format, and leaves RenderResult::pixels empty.
+	template<typename Pixel>
+	auto run_coordinator(const Camera& camera, const Scene& scene, const CoordinatorSettings& settings, std::span<Pixel> pixels, const RenderControl& control = {}) -> RenderResult;
+	// Returns false when the coordinator could not be reached.
+	auto run_worker(const std::string& socket_path) -> bool;
+}
+
+#endif // _DISTRIBUTED_H_
@@ -0,0 +1,47 @@
+#ifndef _EXR_H_
+#define _EXR_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <span>
+
+#include "aov.h"
+
+namespace raytracer
+{
+	// The values are the file's own codes. zips compresses each scanline alone, zip blocks of 16.
+	enum class ExrCompression : uint8_t { none = 0, rle = 1, zips = 2, zip = 3 };
+
+	struct ExrSettings {
+		ExrCompression compression = ExrCompression::zip;
+		// Half floats halve the file, but keep 11 significant bits, so depth and ids past 2048 lose precision.
+		bool is_half = false;
+	};
+
+	/*
+		Writes the channels as a single part, scanline OpenEXR image, each channel a plane of
+		width * height values. Readers group names with a dot into layers, so "albedo.R" is the
+		red channel of the albedo layer, and undotted R, G and B are the main image. Blocks of
+		scanlines are compressed on every hardware thread. Returns false when the file could
+		not be written or a channel is the wrong size.
+	*/
+	auto write_exr(
+		const std::string& file_name,
+		const size_t& width,
+		const size_t& height,
+		std::span<const ImageChannel> channels,
+		const ExrSettings& settings = {}) -> bool;
+
+	/*
+		Writes one or three channels as a greyscale or colour PFM, the plain float format most
+		image tools read when they lack EXR support. PFM has no layers, so each layer needs a file.
+	*/
+	auto write_pfm(
+		const std::string& file_name,
+		const size_t& width,
+		const size_t& height,
+		std::span<const ImageChannel> channels) -> bool;
+}
+
+#endif // _EXR_H_
@@ -0,0 +1,88 @@
+#ifndef _KERNEL_H_
+#define _KERNEL_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <optional>
+#include <utility>
+#include <algorithm>
+
+#include "raytracer.h"
+
+namespace raytracer
+{
+	// The material kinds a kernel can shade, one bit per MaterialKind.
+	using MaterialSet = uint32_t;
+
+	constexpr auto get_material_bit(const MaterialKind& kind) -> MaterialSet {
+		return MaterialSet(1) << uint32_t(kind);
+	}
+	constexpr MaterialSet ALL_MATERIALS = (MaterialSet(1) << MATERIAL_KIND_COUNT) - 1;
+
+	/*
+		The values the render kernels are compiled for. Every combination is its own kernel, so each
+		list multiplies the number of them. The first sample count must be 1, progressive renders use
+		those kernels. Material sets go from smallest to largest and end with every kind.
+	*/
+	constexpr std::array<size_t, 3> KERNEL_RAY_DEPTHS = { 1, 4, DEFAULT_RAY_DEPTH };
+	constexpr std::array<size_t, 4> KERNEL_SAMPLE_COUNTS = { 1, DEFAULT_SAMPLES_PER_PIXEL, 4, 8 };
+	constexpr std::array<MaterialSet, 2> KERNEL_MATERIAL_SETS = { get_material_bit(MaterialKind::diffuse), ALL_MATERIALS };
+	constexpr size_t KERNEL_COUNT = KERNEL_SAMPLE_COUNTS.size() * KERNEL_RAY_DEPTHS.size() * KERNEL_MATERIAL_SETS.size() * 2;
+	constexpr size_t PASS_KERNEL_COUNT = KERNEL_COUNT / KERNEL_SAMPLE_COUNTS.size();
+
+	/*
+		A render kernel's options as constants. ray_depth caps diffuse bounces and mirror or glass
+		reflections, materials leaves out the shading code of kinds the scene does not use, and
+		without AOVs no AOV code is compiled into the kernel at all.
+	*/
+	template<size_t RAY_DEPTH, size_t SAMPLES_PER_PIXEL, MaterialSet MATERIALS, bool HAS_AOVS>
+	struct KernelFeatures {
+		static constexpr size_t ray_depth = RAY_DEPTH;
+		static constexpr size_t samples_per_pixel = SAMPLES_PER_PIXEL;
+		static constexpr MaterialSet materials = MATERIALS;
+		static constexpr bool has_aovs = HAS_AOVS;
+
+		static constexpr auto can_shade(const MaterialKind& kind) { return (materials & get_material_bit(kind)) != 0; }
+	};
+
+	// Sample counts are the most significant digit, so the first PASS_KERNEL_COUNT kernels take one sample.
+	template<size_t INDEX>
+	using KernelFeaturesAt = KernelFeatures<
+		KERNEL_RAY_DEPTHS[INDEX / (KERNEL_MATERIAL_SETS.size() * 2) % KERNEL_RAY_DEPTHS.size()],
+		KERNEL_SAMPLE_COUNTS[INDEX / (KERNEL_RAY_DEPTHS.size() * KERNEL_MATERIAL_SETS.size() * 2)],
+		KERNEL_MATERIAL_SETS[INDEX / 2 % KERNEL_MATERIAL_SETS.size()],
+		INDEX % 2 == 1>;
+
+	// Returns the position of the kernel compiled for the options, empty when there is none.
+	constexpr auto get_kernel_index(
+		const size_t& ray_depth,
+		const size_t& samples_per_pixel,
+		const MaterialSet& materials,
+		const bool& has_aovs) -> std::optional<size_t> {
+		const auto depth = std::find(KERNEL_RAY_DEPTHS.begin(), KERNEL_RAY_DEPTHS.end(), ray_depth);
+		const auto samples = std::find(KERNEL_SAMPLE_COUNTS.begin(), KERNEL_SAMPLE_COUNTS.end(), samples_per_pixel);
+		const auto material_set = std::find_if(KERNEL_MATERIAL_SETS.begin(), KERNEL_MATERIAL_SETS.end(),
+			[&](const auto& set) { return (set & materials) == materials; });
+		if (depth == KERNEL_RAY_DEPTHS.end() || samples == KERNEL_SAMPLE_COUNTS.end() || material_set == KERNEL_MATERIAL_SETS.end()) {
+			return {};
+		}
+		const auto depth_index = size_t(depth - KERNEL_RAY_DEPTHS.begin());
+		const auto samples_index = size_t(samples - KERNEL_SAMPLE_COUNTS.begin());
+		const auto material_index = size_t(material_set - KERNEL_MATERIAL_SETS.begin());
+		return ((samples_index * KERNEL_RAY_DEPTHS.size() + depth_index) * KERNEL_MATERIAL_SETS.size() + material_index) * 2 + (has_aovs ? 1 : 0);
+	}
+
+	/*
+		A table of Kernel<Features>::run for the first COUNT kernels, to pick an instantiation at runtime
+		with one index instead of a branch per option in the hot loop.
+	*/
+	template<template<typename> typename Kernel, size_t COUNT>
+	constexpr auto make_kernel_table() {
+		return []<size_t... INDICES>(std::index_sequence<INDICES...>) {
+			return std::array{ &Kernel<KernelFeaturesAt<INDICES>>::run... };
+		}(std::make_index_sequence<COUNT>{});
+	}
+}
+
+#endif // _KERNEL_H_
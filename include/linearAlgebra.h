@@ -3,37 +3,59 @@
 
 #include <iostream>
 #include <math.h>
+#include <cmath>
 
-constexpr static auto MOE = 0.00001;     
+#include "raytracer_config.h"
+
+constexpr static auto MOE = 0.00001;
 constexpr static auto PI  = 3.1415926535;
 
 /*
-    Floating point operations are never perfect so there are rounding issues. 
+    RAYTRACER_PRECISION picks Real, the scalar of vec3, uvec3, pt3, Ray and the ray/sphere
+    intersections, in raytracer_config.h: float, or double for scenes with large spheres.
+*/
+#if defined(RAYTRACER_PRECISION_DOUBLE)
+using Real = double;
+#else
+using Real = float;
+#endif
+
+// How close to its origin a hit along a ray may be and still count, which hides the surface the ray starts from.
+constexpr Real HIT_EPSILON = 0.00001;
+constexpr Real SHADOW_EPSILON = 0.0001;
+
+/*
+    Floating point operations are never perfect so there are rounding issues.
     This function allows an easy way to have a margin of error.
-*/ 
+*/
 inline auto margin_of_error(const float& cmp, const float& value) -> bool {
     return ((cmp < value + MOE) && (cmp > value - MOE)) ? true : false;;
 }
-inline auto round(const float& cmp,const float& value, const float& moe = MOE) {
+template<typename T>
+inline auto round(const T& cmp, const T& value, const T& moe) {
     return (value < (moe + cmp) )&& (value > (cmp-moe)) ? cmp : value;
 }
+inline auto round(const float& cmp,const float& value, const float& moe = MOE) {
+    return round<float>(cmp, value, moe);
+}
 
 
-struct vec3 {
-    float i, j, k;
+template<typename T>
+struct basic_vec3 {
+    T i, j, k;
 
     void print() const {
         std::cout << "{ " << i << ", " << j << ", " << k << " }\n";
     }
-    friend vec3 operator+(vec3 lhs, const vec3& rhs) {
-        return vec3{
+    friend basic_vec3 operator+(basic_vec3 lhs, const basic_vec3& rhs) {
+        return basic_vec3{
             lhs.i + rhs.i,
             lhs.j + rhs.j,
             lhs.k + rhs.k
         };
     }
-    friend vec3 operator-(vec3 lhs, const vec3& rhs) {
-        return vec3{
+    friend basic_vec3 operator-(basic_vec3 lhs, const basic_vec3& rhs) {
+        return basic_vec3{
             lhs.i - rhs.i,
             lhs.j - rhs.j,
             lhs.k - rhs.k
@@ -41,23 +63,26 @@ struct vec3 {
     }
 };
 
-inline auto magnitude(const vec3& v) -> float {
-    return sqrt(v.i*v.i + v.j*v.j + v.k*v.k);
+template<typename T>
+inline auto magnitude(const basic_vec3<T>& v) -> T {
+    return std::sqrt(v.i*v.i + v.j*v.j + v.k*v.k);
 }
-inline auto length_sqaured(const vec3& v) -> float {
+template<typename T>
+inline auto length_sqaured(const basic_vec3<T>& v) -> T {
     return v.i*v.i + v.j*v.j + v.k*v.k;
 }
 
-struct uvec3
+template<typename T>
+struct basic_uvec3
 {
-    float i, j, k;
-    inline uvec3(const float& i_, const float& j_, const float& k_) {
-        const auto mag = magnitude(vec3{i_, j_, k_ });
+    T i, j, k;
+    inline basic_uvec3(const T& i_, const T& j_, const T& k_) {
+        const auto mag = magnitude(basic_vec3<T>{i_, j_, k_ });
         i = i_ / mag;
         j = j_ / mag;
         k = k_ / mag;
     }
-    inline uvec3(const vec3& v) {
+    inline basic_uvec3(const basic_vec3<T>& v) {
         const auto mag = magnitude(v);
         i = v.i / mag;
         j = v.j / mag;
@@ -68,14 +93,16 @@ struct uvec3
     }
 };
 
-inline constexpr auto magnitude(const uvec3& v) -> float {
-    return 1.0f;
+template<typename T>
+inline constexpr auto magnitude(const basic_uvec3<T>& v) -> T {
+    return 1;
 }
 
 
-struct pt3{
-    float x, y, z;
-    pt3(const float& x_, const float& y_, const float& z_)
+template<typename T>
+struct basic_pt3{
+    T x, y, z;
+    basic_pt3(const T& x_, const T& y_, const T& z_)
         : x(x_), y(y_), z(z_)
     {}
     void print() const {
@@ -83,32 +110,49 @@ struct pt3{
     }
 };
 
-inline auto normalise(const vec3& v) -> uvec3 {
+using vec3 = basic_vec3<Real>;
+using uvec3 = basic_uvec3<Real>;
+using pt3 = basic_pt3<Real>;
+
+// Converts between scalars, to solve in double what is stored as float.
+template<typename To, typename From>
+inline auto cast(const basic_vec3<From>& v) -> basic_vec3<To> {
+    return basic_vec3<To>{ To(v.i), To(v.j), To(v.k) };
+}
+template<typename To, typename From>
+inline auto cast(const basic_pt3<From>& p) -> basic_pt3<To> {
+    return basic_pt3<To>{ To(p.x), To(p.y), To(p.z) };
+}
+
+template<typename T>
+inline auto normalise(const basic_vec3<T>& v) -> basic_uvec3<T> {
     auto mag = magnitude(v);
-    return uvec3{v.i/mag, v.j/mag, v.k/mag};
+    return basic_uvec3<T>{v.i/mag, v.j/mag, v.k/mag};
 }
 
-class Ray
+template<typename T>
+class basic_ray
 {
 public:
-    const uvec3 direction;
-    const pt3  origin;
+    const basic_uvec3<T> direction;
+    const basic_pt3<T>  origin;
 
-    inline Ray(const vec3& direction_, const pt3& origin_) 
-        : direction(normalise(direction_)), origin(origin_) 
+    inline basic_ray(const basic_vec3<T>& direction_, const basic_pt3<T>& origin_)
+        : direction(normalise(direction_)), origin(origin_)
     {}
-    inline Ray(const uvec3& direction_, pt3 origin_) 
+    inline basic_ray(const basic_uvec3<T>& direction_, basic_pt3<T> origin_)
         : direction(direction_), origin(origin_)
     {}
 
-    inline auto pt_at(float t) const -> pt3 {
-        return { 
-            origin.x + t * direction.i, 
-            origin.y + t * direction.j, 
-            origin.z + t * direction.k 
+    inline auto pt_at(T t) const -> basic_pt3<T> {
+        return {
+            origin.x + t * direction.i,
+            origin.y + t * direction.j,
+            origin.z + t * direction.k
         };
     }
 };
+using Ray = basic_ray<Real>;
 
 class Angle
 {
@@ -116,11 +160,11 @@ private:
     // angle_ stored in radians, as mathematically preffered unit.
     float angle_;
 public:
-    Angle(const float& angle) : 
+    Angle(const float& angle) :
         angle_(angle)
     {}
-    inline auto radians() const -> float{ 
-        return angle_; 
+    inline auto radians() const -> float{
+        return angle_;
     }
     inline auto degrees() const -> float {
         return angle_ / PI * 180;
@@ -133,59 +177,71 @@ inline auto degrees_to_radians(const float& degrees) -> float{
     return degrees * PI / 180;
 }
 
-inline auto dot_product(const vec3& v1, const vec3& v2) -> float {
+template<typename T>
+inline auto dot_product(const basic_vec3<T>& v1, const basic_vec3<T>& v2) -> T {
     return (v1.i * v2.i) + (v1.j * v2.j) + (v1.k * v2.k);
 }
-inline auto dot_product(const uvec3& v1, const uvec3& v2) -> float {
+template<typename T>
+inline auto dot_product(const basic_uvec3<T>& v1, const basic_uvec3<T>& v2) -> T {
     return (v1.i * v2.i) + (v1.j * v2.j) + (v1.k * v2.k);
 }
 
-inline auto angle(const vec3& v1, const vec3& v2) -> Angle {
-    return Angle{ acosf(dot_product(v1, v2) / magnitude(v1) / magnitude(v2)) };
+template<typename T>
+inline auto angle(const basic_vec3<T>& v1, const basic_vec3<T>& v2) -> Angle {
+    return Angle{ float(std::acos(dot_product(v1, v2) / magnitude(v1) / magnitude(v2))) };
 }
 
-inline auto cross_product(const vec3& v1, const vec3& v2) -> vec3{
-    return vec3{
+template<typename T>
+inline auto cross_product(const basic_vec3<T>& v1, const basic_vec3<T>& v2) -> basic_vec3<T>{
+    return basic_vec3<T>{
         v1.j*v2.k - v1.k*v2.j,
         v1.k*v2.i - v1.i*v2.k,
         v1.i*v2.j - v1.j*v2.i
     };
 }
-inline auto is_orthogonal(const vec3& v1, const vec3& v2) -> bool {
+template<typename T>
+inline auto is_orthogonal(const basic_vec3<T>& v1, const basic_vec3<T>& v2) -> bool {
     return margin_of_error(angle(v1, v2).radians(), PI / 2);
 }
-inline auto is_normalised(const vec3& v) -> bool {
+template<typename T>
+inline auto is_normalised(const basic_vec3<T>& v) -> bool {
     return margin_of_error(magnitude(v), 1);
 }
 
 //Ray is composed of a pt3 and vec3, aka origin and direction respectively
-inline auto pt_from_ray(const pt3& origin, const vec3& direction ,const float& t) -> pt3 {
-    return pt3{
+template<typename T>
+inline auto pt_from_ray(const basic_pt3<T>& origin, const basic_vec3<T>& direction ,const T& t) -> basic_pt3<T> {
+    return basic_pt3<T>{
         origin.x + t * direction.i,
         origin.y + t * direction.j,
         origin.z + t * direction.k
     };
 }
-inline auto vec_from_pts(const pt3& final, const pt3& intial) -> vec3 {
-    return vec3{
+template<typename T>
+inline auto vec_from_pts(const basic_pt3<T>& final, const basic_pt3<T>& intial) -> basic_vec3<T> {
+    return basic_vec3<T>{
         (final.x - intial.x),
         (final.y - intial.y),
-        (final.z - intial.z) 
+        (final.z - intial.z)
     };
 }
-inline auto uvec_to_vec(const uvec3& v) -> vec3 {
-    return vec3{v.i, v.j, v.k};
+template<typename T>
+inline auto uvec_to_vec(const basic_uvec3<T>& v) -> basic_vec3<T> {
+    return basic_vec3<T>{v.i, v.j, v.k};
 }
 
-inline auto min_dist(const pt3& line_point, const vec3& line_direction, const pt3& point) {
+template<typename T>
+inline auto min_dist(const basic_pt3<T>& line_point, const basic_vec3<T>& line_direction, const basic_pt3<T>& point) {
     return magnitude(cross_product(vec_from_pts(line_point, point), line_direction)) / magnitude(line_direction);
 }
-inline auto min_dist(const Ray& ray, const pt3 point) {
+template<typename T>
+inline auto min_dist(const basic_ray<T>& ray, const basic_pt3<T> point) {
     return magnitude(cross_product(vec_from_pts(ray.origin, point), uvec_to_vec(ray.direction))) / magnitude(ray.direction);
 }
-inline auto get_t(const pt3& origin, const vec3& direction, const pt3& point) {
-    
+template<typename T>
+inline auto get_t(const basic_pt3<T>& origin, const basic_vec3<T>& direction, const basic_pt3<T>& point) {
+
     return (direction.i == 0) ? (point.x - origin.x) / direction.i : (point.y - origin.y) / direction.j;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,132 @@
+#ifndef _OUTPUT_PIPELINE_H_
+#define _OUTPUT_PIPELINE_H_
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <optional>
+#include <functional>
+#include <algorithm>
+#include <iostream>
+#include <span>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "raytracer.h"
+#include "trace.h"
+
+namespace raytracer
+{
+	/*
+		Encodes and writes frames on a background thread while the next frame renders.
+		The pipeline owns a fixed number of frame buffers. acquire() hands one out to render into
+		and blocks while every buffer is still queued for writing, which is the backpressure that
+		keeps a fast renderer from running ahead of a slow disk. Frames are written in submit order.
+	*/
+	template<typename Pixel>
+	class OutputPipeline {
+	public:
+		using Encoder = std::function<bool(const std::string& file_name, const ImageView<Pixel>& image)>;
+		struct Frame {
+			std::span<Pixel> pixels;
+			size_t buffer_index;
+		};
+
+	private:
+		struct Job {
+			size_t buffer_index;
+			std::string file_name;
+			std::optional<Tile> region;
+		};
+		const size_t width_;
+		const size_t height_;
+		const Encoder encode_;
+		std::vector<std::vector<Pixel>> buffers_;
+		std::vector<size_t> free_buffers_;
+		std::deque<Job> jobs_;
+		bool is_stopping_ = false;
+		std::mutex mutex_;
+		std::condition_variable has_job_;
+		std::condition_variable has_free_buffer_;
+		std::thread thread_;
+
+		auto write_loop() -> void {
+			std::unique_lock lock{ mutex_ };
+			while (true) {
+				has_job_.wait(lock, [&]() { return !jobs_.empty() || is_stopping_; });
+				if (jobs_.empty()) {
+					return;
+				}
+				const auto job = std::move(jobs_.front());
+				jobs_.pop_front();
+
+				lock.unlock();
+				const auto image = ImageView<Pixel>{ buffers_[job.buffer_index], width_, height_ };
+				if (!encode_(job.file_name, job.region.has_value() ? crop(image, *job.region) : image)) [[unlikely]] {
+					std::cout << "OUTPUT ERROR:\tCould not write " << job.file_name << "\n";
+				}
+				lock.lock();
+				free_buffers_.push_back(job.buffer_index);
+				has_free_buffer_.notify_all();
+			}
+		}
+
+	public:
+		// Two buffers are enough to overlap one write with one render, more absorb uneven write times.
+		OutputPipeline(const size_t& width, const size_t& height, const size_t& buffer_count = 2, Encoder encode = write_ppm<Pixel>)
+			: width_(width), height_(height), encode_(std::move(encode)),
+			buffers_(std::max<size_t>(buffer_count, 1), std::vector<Pixel>(width * height))
+		{
+			for (size_t i = buffers_.size(); i > 0; --i) {
+				free_buffers_.push_back(i - 1);
+			}
+			thread_ = std::thread(&OutputPipeline::write_loop, this);
+		}
+		// Writes everything already submitted before returning.
+		~OutputPipeline() {
+			{
+				std::lock_guard lock{ mutex_ };
+				is_stopping_ = true;
+			}
+			has_job_.notify_one();
+			thread_.join();
+		}
+		OutputPipeline(const OutputPipeline&) = delete;
+		auto operator=(const OutputPipeline&) -> OutputPipeline& = delete;
+
+		// The buffer is cleared, so pixels a stopped render never reached are black rather than an older frame.
+		auto acquire() -> Frame {
+			size_t buffer_index;
+			{
+				std::unique_lock lock{ mutex_ };
+				if (free_buffers_.empty()) {
+					trace::ScopedEvent event{ "output wait" };
+					has_free_buffer_.wait(lock, [&]() { return !free_buffers_.empty(); });
+				}
+				buffer_index = free_buffers_.back();
+				free_buffers_.pop_back();
+			}
+			auto& buffer = buffers_[buffer_index];
+			std::fill(buffer.begin(), buffer.end(), Pixel{});
+			return Frame{ buffer, buffer_index };
+		}
+
+		// Only the region of the frame is written when one is given.
+		auto submit(const Frame& frame, std::string file_name, std::optional<Tile> region = {}) -> void {
+			{
+				std::lock_guard lock{ mutex_ };
+				jobs_.push_back(Job{ frame.buffer_index, std::move(file_name), region });
+			}
+			has_job_.notify_one();
+		}
+
+		// Blocks until every submitted frame has been written, call it with no frame still acquired.
+		auto flush() -> void {
+			std::unique_lock lock{ mutex_ };
+			has_free_buffer_.wait(lock, [&]() { return free_buffers_.size() == buffers_.size(); });
+		}
+	};
+}
+
+#endif // _OUTPUT_PIPELINE_H_
@@ -0,0 +1,206 @@
+#ifndef _PIXEL_FORMATS_H_
+#define _PIXEL_FORMATS_H_
+
+#include <cstdint>
+#include <bit>
+#include <type_traits>
+#include <algorithm>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <variant>
+
+/*
+	Framebuffer pixel formats. RGB is the renderer's working colour, 8-bit values held in ints.
+	The compact formats trade that for 3 to 12 bytes per pixel. Every conversion goes through
+	linear RGBf in 0 to 1, so any format can be converted to any other with convert_pixels().
+*/
+struct RGB {
+	int r, g, b;
+	auto multiply(const float& factor) const {
+		return RGB{
+			int(r*factor),
+			int(g*factor),
+			int(b*factor)
+		};
+	}
+};
+struct RGBf { float r, g, b; };
+
+struct RGB8 { uint8_t r, g, b; };
+struct RGBA8 { uint8_t r, g, b, a; };
+struct RGB16 { uint16_t r, g, b; };
+
+// IEEE 754 binary16, stored as bits and converted through float.
+struct Half {
+	uint16_t bits;
+
+	static constexpr auto from_float(const float& value) -> Half {
+		const auto f = std::bit_cast<uint32_t>(value);
+		const auto sign = uint16_t((f >> 16) & 0x8000);
+		const auto exponent = int((f >> 23) & 0xff) - 127 + 15;
+		auto mantissa = f & 0x7fffff;
+
+		if (((f >> 23) & 0xff) == 0xff) {
+			return Half{ uint16_t(sign | 0x7c00 | (mantissa ? 0x200 : 0)) };
+		}
+		if (exponent >= 31) {
+			return Half{ uint16_t(sign | 0x7c00) };
+		}
+		if (exponent <= 0) {
+			if (exponent < -10) {
+				return Half{ sign };
+			}
+			mantissa |= 0x800000;
+			const auto shift = uint32_t(14 - exponent);
+			const auto halfway = 1u << (shift - 1);
+			auto bits = mantissa >> shift;
+			const auto rest = mantissa & ((1u << shift) - 1);
+			bits += (rest > halfway || (rest == halfway && (bits & 1))) ? 1 : 0;
+			return Half{ uint16_t(sign | bits) };
+		}
+		// Round to nearest even, a carry out of the mantissa correctly bumps the exponent.
+		auto bits = uint32_t(exponent << 10) | (mantissa >> 13);
+		const auto rest = mantissa & 0x1fff;
+		bits += (rest > 0x1000 || (rest == 0x1000 && (bits & 1))) ? 1 : 0;
+		return Half{ uint16_t(sign | bits) };
+	}
+	constexpr auto to_float() const -> float {
+		const auto sign = uint32_t(bits & 0x8000) << 16;
+		const auto exponent = uint32_t(bits >> 10) & 0x1f;
+		auto mantissa = uint32_t(bits & 0x3ff);
+		uint32_t f;
+		if (exponent == 0x1f) {
+			f = sign | 0x7f800000 | (mantissa << 13);
+		}
+		else if (exponent != 0) {
+			f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+		}
+		else if (mantissa == 0) {
+			f = sign;
+		}
+		else {
+			auto shifted_exponent = 127 - 15 + 1;
+			while ((mantissa & 0x400) == 0) {
+				mantissa <<= 1;
+				shifted_exponent--;
+			}
+			f = sign | (uint32_t(shifted_exponent) << 23) | ((mantissa & 0x3ff) << 13);
+		}
+		return std::bit_cast<float>(f);
+	}
+};
+struct RGBh { Half r, g, b; };
+
+namespace raytracer
+{
+	enum class PixelFormat { rgb, rgb8, rgba8, rgb16, half, float32 };
+
+	template<typename Pixel> struct PixelTraits;
+
+	template<typename Integer, int MAX>
+	constexpr auto to_unorm(const float& value) {
+		return Integer(std::clamp(value, 0.0f, 1.0f) * MAX + 0.5f);
+	}
+
+	template<> struct PixelTraits<RGB> {
+		static constexpr auto format = PixelFormat::rgb;
+		static constexpr std::string_view name = "rgb";
+		static constexpr auto encode(const RGBf& c) { return RGB{ int(c.r * 255 + 0.5f), int(c.g * 255 + 0.5f), int(c.b * 255 + 0.5f) }; }
+		static constexpr auto decode(const RGB& p) { return RGBf{ p.r / 255.0f, p.g / 255.0f, p.b / 255.0f }; }
+	};
+	template<> struct PixelTraits<RGB8> {
+		static constexpr auto format = PixelFormat::rgb8;
+		static constexpr std::string_view name = "rgb8";
+		static constexpr auto encode(const RGBf& c) { return RGB8{ to_unorm<uint8_t, 255>(c.r), to_unorm<uint8_t, 255>(c.g), to_unorm<uint8_t, 255>(c.b) }; }
+		static constexpr auto decode(const RGB8& p) { return RGBf{ p.r / 255.0f, p.g / 255.0f, p.b / 255.0f }; }
+	};
+	// Alpha is always opaque, the renderer has no coverage to put in it.
+	template<> struct PixelTraits<RGBA8> {
+		static constexpr auto format = PixelFormat::rgba8;
+		static constexpr std::string_view name = "rgba8";
+		static constexpr auto encode(const RGBf& c) { return RGBA8{ to_unorm<uint8_t, 255>(c.r), to_unorm<uint8_t, 255>(c.g), to_unorm<uint8_t, 255>(c.b), 255 }; }
+		static constexpr auto decode(const RGBA8& p) { return RGBf{ p.r / 255.0f, p.g / 255.0f, p.b / 255.0f }; }
+	};
+	template<> struct PixelTraits<RGB16> {
+		static constexpr auto format = PixelFormat::rgb16;
+		static constexpr std::string_view name = "rgb16";
+		static constexpr auto encode(const RGBf& c) { return RGB16{ to_unorm<uint16_t, 65535>(c.r), to_unorm<uint16_t, 65535>(c.g), to_unorm<uint16_t, 65535>(c.b) }; }
+		static constexpr auto decode(const RGB16& p) { return RGBf{ p.r / 65535.0f, p.g / 65535.0f, p.b / 65535.0f }; }
+	};
+	template<> struct PixelTraits<RGBh> {
+		static constexpr auto format = PixelFormat::half;
+		static constexpr std::string_view name = "half";
+		static constexpr auto encode(const RGBf& c) { return RGBh{ Half::from_float(c.r), Half::from_float(c.g), Half::from_float(c.b) }; }
+		static constexpr auto decode(const RGBh& p) { return RGBf{ p.r.to_float(), p.g.to_float(), p.b.to_float() }; }
+	};
+	template<> struct PixelTraits<RGBf> {
+		static constexpr auto format = PixelFormat::float32;
+		static constexpr std::string_view name = "float";
+		static constexpr auto encode(const RGBf& c) { return c; }
+		static constexpr auto decode(const RGBf& p) { return p; }
+	};
+
+	// Encodes one of the renderer's 8-bit colours, exact for every format.
+	template<typename Pixel>
+	constexpr auto encode(const RGB& colour) -> Pixel {
+		if constexpr (std::is_same_v<Pixel, RGB>) {
+			return colour;
+		}
+		else if constexpr (std::is_same_v<Pixel, RGB8>) {
+			return RGB8{ uint8_t(std::clamp(colour.r, 0, 255)), uint8_t(std::clamp(colour.g, 0, 255)), uint8_t(std::clamp(colour.b, 0, 255)) };
+		}
+		else {
+			return PixelTraits<Pixel>::encode(PixelTraits<RGB>::decode(colour));
+		}
+	}
+
+	// Plain loops over contiguous arrays so the compiler can vectorise each pair of formats.
+	template<typename From, typename To>
+	auto convert_pixels(std::span<const From> from, std::span<To> to) -> void {
+		const auto count = std::min(from.size(), to.size());
+		if constexpr (std::is_same_v<From, To>) {
+			std::copy_n(from.begin(), count, to.begin());
+		}
+		else if constexpr (std::is_same_v<From, RGB>) {
+			for (size_t i = 0; i < count; ++i) {
+				to[i] = encode<To>(from[i]);
+			}
+		}
+		else {
+			for (size_t i = 0; i < count; ++i) {
+				to[i] = PixelTraits<To>::encode(PixelTraits<From>::decode(from[i]));
+			}
+		}
+	}
+
+	// A read only span over a framebuffer of any format, for code that has to handle all of them.
+	using PixelSpan = std::variant<
+		std::span<const RGB>, std::span<const RGB8>, std::span<const RGBA8>,
+		std::span<const RGB16>, std::span<const RGBh>, std::span<const RGBf>>;
+
+	// Calls visitor with a default constructed pixel of the format, to pick a template instantiation at runtime.
+	template<typename Visitor>
+	auto visit_pixel_format(const PixelFormat& format, Visitor&& visitor) {
+		switch (format) {
+		case PixelFormat::rgb8:		return visitor(RGB8{});
+		case PixelFormat::rgba8:	return visitor(RGBA8{});
+		case PixelFormat::rgb16:	return visitor(RGB16{});
+		case PixelFormat::half:		return visitor(RGBh{});
+		case PixelFormat::float32:	return visitor(RGBf{});
+		default:					return visitor(RGB{});
+		}
+	}
+
+	inline auto parse_pixel_format(std::string_view name) -> std::optional<PixelFormat> {
+		for (const auto& format : { PixelFormat::rgb, PixelFormat::rgb8, PixelFormat::rgba8, PixelFormat::rgb16, PixelFormat::half, PixelFormat::float32 }) {
+			const auto format_name = visit_pixel_format(format, [](const auto& pixel) { return PixelTraits<std::decay_t<decltype(pixel)>>::name; });
+			if (name == format_name) {
+				return format;
+			}
+		}
+		return {};
+	}
+}
+
+#endif // _PIXEL_FORMATS_H_
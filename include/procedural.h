@@ -0,0 +1,37 @@
+#ifndef _PROCEDURAL_H_
+#define _PROCEDURAL_H_
+
+#include <cstdint>
+#include <span>
+
+#include "pixel_formats.h"
+
+/*
+	Procedural albedo, blended from colour_a to colour_b by a pattern evaluated at the hit point
+	relative to the shape's centre, so the pattern moves with the shape. scale is the number of
+	pattern repeats per unit length, for gradient it is the inverse of the half height it spans.
+*/
+enum class Pattern : uint8_t { checker, gradient, noise, marble };
+struct ProceduralTexture {
+	Pattern pattern;
+	RGB colour_a;
+	RGB colour_b;
+	float scale = 1;
+};
+
+namespace raytracer
+{
+	/*
+		Evaluates the texture at a batch of points given as separate coordinate arrays. Each pattern is
+		a plain loop over the arrays so the compiler can vectorise it, and a batch of one gives the
+		same colour as the same point in any larger batch.
+	*/
+	auto evaluate_procedural(
+		const ProceduralTexture& texture,
+		std::span<const float> x,
+		std::span<const float> y,
+		std::span<const float> z,
+		std::span<RGB> colours) -> void;
+}
+
+#endif // _PROCEDURAL_H_
@@ -8,22 +8,28 @@
 #include <iostream>
 #include <cstdlib>
 #include <variant>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <optional>
+#include <span>
+#include <memory>
 
+#include "raytracer_config.h"
 #include "shapes.h"
 #include "linearAlgebra.h"
+#include "pixel_formats.h"
+#include "procedural.h"
+#include "denoise.h"
+#include "aov.h"
 
-struct RGB { 
-	int r, g, b; 
-	auto multiply(const float& factor) const {
-		return RGB{
-			int(r*factor),
-			int(g*factor),
-			int(b*factor)
-		};
-	}
-};
+// Fraction of the reflected colour a mirror keeps, 1 is a perfect mirror.
 struct Metal { float reflect_amount; };
-struct Glass { float blur_amount; };
+// Blur jitters the reflected and refracted rays, 0 is clear glass.
+struct Glass { float blur_amount; float refractive_index = 1.5f; };
+// Diffuse with the colour looked up in a texture added to the scene's TextureCache.
+struct ImageTexture { uint32_t texture; };
 
 class PPM
 {
@@ -33,20 +39,49 @@ public:
 	int height_;
 public:
 	void change_dimensions(const int& width, const int& height);
+	// Sized to the full frame on construction, so the renderer can write straight into it through pixels().
 	std::vector<RGB> colour_info;
 	PPM(const std::string& file_name, const int& width, const int& height);
+	auto pixels() -> std::span<RGB> { return colour_info; }
 	auto create_ppm() -> void;
 };
 
 
-using Material = std::variant<RGB, Metal, Glass>;
+using Material = std::variant<RGB, Metal, Glass, ImageTexture, ProceduralTexture>;
 
 namespace raytracer
 {
+	class TextureCache;
+
+	enum class MaterialKind : uint8_t { diffuse, metal, glass, textured, procedural };
+	constexpr size_t MATERIAL_KIND_COUNT = 5;
+
+	/*
+		Materials as parallel arrays indexed by shape, so shading a hit is a one byte tag lookup and a switch.
+		A Material variant is only visited when it is added. amounts holds reflect_amount for metal and
+		blur_amount for glass, colours only matters for diffuse shapes, textures for textured ones and procedurals for procedural ones.
+	*/
+	struct MaterialTable {
+		std::vector<MaterialKind> kinds;
+		std::vector<RGB> colours;
+		std::vector<float> amounts;
+		std::vector<float> refractive_indices;
+		std::vector<uint32_t> textures;
+		std::vector<ProceduralTexture> procedurals;
+
+		auto add(const Material& material) -> void;
+		auto size() const { return kinds.size(); }
+	};
+
 	struct Scene {
-		std::vector<Material> materials;
+		MaterialTable materials;
 		std::vector<shapes::Sphere> spheres;
 		std::vector<pt3> point_lights;
+		// Shared by copies of the scene, created with the default budget by the first load_texture() if not set.
+		std::shared_ptr<TextureCache> textures;
+
+		// Empty when the image can't be read.
+		auto load_texture(const std::string& image_path) -> std::optional<ImageTexture>;
 		auto get_index(const shapes::Sphere* ptr) const
 		{
 			auto iter = std::find_if(spheres.begin(), spheres.end(),
@@ -90,12 +125,12 @@ namespace raytracer
 			point_lights.emplace_back(position.x - offset, position.y - offset, position.z - offset);
 
 		}
-		auto make_sphere(const pt3& position, const float& radius, const RGB& material = {0,0,200}) {
-			materials.emplace_back(material);
+		auto make_sphere(const pt3& position, const float& radius, const Material& material = RGB{0,0,200}) {
+			materials.add(material);
 			spheres.emplace_back(position, radius);
 		}
-		auto make_sphere(const shapes::Sphere& s, const RGB& material = { 0,0,200 }) {
-			materials.emplace_back(material);
+		auto make_sphere(const shapes::Sphere& s, const Material& material = RGB{ 0,0,200 }) {
+			materials.add(material);
 			spheres.emplace_back(s);
 		}
 	};
@@ -115,6 +150,8 @@ namespace raytracer
 		constexpr auto get_my()				const { return -2.0f / height; }
 		constexpr auto get_aspect_ratio()	const { return  float(width / height); }
 		const	auto get_fov_adjustment()	const { return tan(fov.radians() / 2); }
+		// Height of one pixel's footprint at distance 1 from the camera, used to pick texture MIP levels.
+		const	auto get_pixel_spread()		const { return 2 * get_fov_adjustment() / height; }
 
 	};
 
@@ -126,8 +163,176 @@ namespace raytracer
 		// left_low + vertical + horizontal = right_high
 	};
 
+	// Half open pixel rectangle, also used to describe regions of interest.
+	struct Tile {
+		size_t x_begin, y_begin, x_end, y_end;
+	};
+	constexpr size_t TILE_SIZE = 32;
+	// A region has to be non-empty and lie inside the frame, render() reports any other as a RENDER ERROR.
+	auto is_valid_region(const Camera& camera, const Tile& region) -> bool;
+	// An empty list of regions covers the whole frame. Overlapping regions are only rendered once.
+	auto make_tiles(const Camera& camera, const std::vector<Tile>& regions = {}) -> std::vector<Tile>;
+	// False colour from black through blue, green and yellow to red, scaled to the 99th percentile cost.
+	auto make_heatmap(const std::vector<float>& pixel_cost) -> std::vector<RGB>;
+
+	// Non-owning view of rows of pixels, stride is the distance between the starts of rows in pixels.
+	template<typename Pixel = RGB>
+	struct ImageView {
+		std::span<const Pixel> pixels;
+		size_t width, height, stride;
+
+		ImageView(std::span<const Pixel> pixels, const size_t& width, const size_t& height, const size_t& stride)
+			: pixels(pixels), width(width), height(height), stride(stride) {}
+		ImageView(std::span<const Pixel> pixels, const size_t& width, const size_t& height)
+			: ImageView(pixels, width, height, width) {}
+		auto row(const size_t& y) const { return pixels.subspan(y * stride, width); }
+	};
+	template<typename Pixels> ImageView(const Pixels&, const size_t&, const size_t&) -> ImageView<std::remove_cv_t<typename Pixels::value_type>>;
+	template<typename Pixels> ImageView(const Pixels&, const size_t&, const size_t&, const size_t&) -> ImageView<std::remove_cv_t<typename Pixels::value_type>>;
+
+	// Views the region of the image in place, the region must lie inside it.
+	template<typename Pixel>
+	auto crop(const ImageView<Pixel>& image, const Tile& region) -> ImageView<Pixel> {
+		const auto offset = region.y_begin * image.stride + region.x_begin;
+		const auto width = region.x_end - region.x_begin;
+		const auto height = region.y_end - region.y_begin;
+		const auto size = height > 0 ? (height - 1) * image.stride + width : 0;
+		return ImageView<Pixel>{ image.pixels.subspan(offset, size), width, height, image.stride };
+	}
+	// Encodes the view as a plain text 8-bit PPM, returning false when the file could not be written.
+	template<typename Pixel>
+	auto write_ppm(const std::string& file_name, const ImageView<Pixel>& image) -> bool;
+
+	class CancellationToken {
+		std::atomic<bool> is_cancelled_{ false };
+	public:
+		auto cancel() -> void { is_cancelled_.store(true, std::memory_order_relaxed); }
+		auto is_cancelled() const -> bool { return is_cancelled_.load(std::memory_order_relaxed); }
+	};
+
+	constexpr size_t DEFAULT_RAY_DEPTH = 10;
+	constexpr size_t DEFAULT_SAMPLES_PER_PIXEL = 2;
+
+	// What to measure per pixel for RenderResult::pixel_cost, time is in nanoseconds. Intersections need RAYTRACER_STATS.
+	enum class PixelCost { none, time, intersections };
+
+	// Stop requests are checked by the render threads before each tile, so they cost at most one tile per thread.
+	struct RenderControl {
+		const CancellationToken* cancellation = nullptr;
+		std::optional<std::chrono::steady_clock::time_point> deadline;
+		std::vector<Tile> regions;
+		PixelCost pixel_cost = PixelCost::none;
+		// Traces a tile's primary rays first and shades the hits grouped by material kind. The image is unchanged.
+		bool sort_by_material = false;
+		// Fills RenderResult::aovs from the render's own rays. Disabled AOVs cost a pointer test per pixel.
+		AovSet aovs;
+		// Filters the finished image guided by the albedo and normal AOVs, which are written too. Progressive previews are not filtered.
+		std::optional<DenoiseSettings> denoise;
+		/*
+			Each combination of these, the scene's material kinds and whether AOVs are written is a kernel
+			compiled with them as constants, so they must be values from the lists in kernel.h. Progressive
+			renders take one sample per pass and ignore samples_per_pixel.
+		*/
+		size_t ray_depth = DEFAULT_RAY_DEPTH;
+		size_t samples_per_pixel = DEFAULT_SAMPLES_PER_PIXEL;
+
+		auto should_stop() const -> bool {
+			return (cancellation && cancellation->is_cancelled())
+				|| (deadline && std::chrono::steady_clock::now() >= *deadline);
+		}
+	};
+
+	/*
+		Bounce rays are the secondary rays traced after the first hit, shadow rays are one per light per hit.
+		Rays and samples are counted in every build, intersection tests only in RAYTRACER_STATS builds.
+	*/
+	struct RayCounts {
+		uint64_t primary = 0;
+		uint64_t bounce = 0;
+		uint64_t shadow = 0;
+		uint64_t samples = 0;
+		uint64_t intersection_tests = 0;
+
+		auto total() const { return primary + bounce + shadow; }
+		auto operator+=(const RayCounts& other) -> RayCounts&;
+	};
+
+	// tile_coverage[i] counts the completed passes over tiles[i], zero means the tile was never finished.
+	struct RenderResult {
+		std::vector<RGB> pixels;
+		std::vector<Tile> tiles;
+		std::vector<uint32_t> tile_coverage;
+		bool is_complete;
+		size_t passes = 0;
+		RayCounts ray_counts;
+		std::chrono::duration<double, std::milli> render_time{ 0 };
+		std::vector<float> pixel_cost;
+		// Planes for the AOVs requested by RenderControl, frame sized, only the rendered tiles are written.
+		AovBuffers aovs;
+	};
+
+	// Running per-pixel sums, resolved to the mean on demand so partial renders are always viewable.
+	struct Accumulator {
+		std::vector<RGBf> colour_sum;
+		std::vector<float> luminance_sq_sum;
+		std::vector<uint32_t> sample_count;
+
+		Accumulator(const size_t& pixel_count);
+		auto add_sample(const size_t& index, const RGB& colour) -> void;
+		auto resolve() const -> std::vector<RGB>;
+		// Pixels that have no samples yet are left untouched.
+		template<typename Pixel>
+		auto resolve(std::span<Pixel> pixels) const -> void;
+		auto mean_relative_error() const -> float;
+	};
+
+	// Zero disables the corresponding interval, budget or threshold.
+	struct ProgressiveSettings {
+		size_t max_passes = 64;
+		size_t preview_pass_interval = 0;
+		std::chrono::milliseconds preview_time_interval{ 0 };
+		std::chrono::milliseconds time_budget{ 0 };
+		float noise_threshold = 0;
+		std::function<void(PixelSpan preview, const size_t& pass)> on_preview;
+
+		uint64_t seed = 0;
+		std::string checkpoint_path;
+		size_t checkpoint_pass_interval = 0;
+		std::chrono::milliseconds checkpoint_time_interval{ 0 };
+		bool resume = false;
+	};
+
+	auto make_default_scene() -> Scene;
+	/*
+		Renders a single tile without threads, returning its pixels row by row. Only the ray depth, samples
+		per pixel and material sorting of the control are used, and a missing kernel falls back silently.
+	*/
+	auto render_tile(const Camera& camera, const Scene& objects, const Tile& tile, const RenderControl& control = {}) -> std::vector<RGB>;
+
 	auto shoot_rays(const int& height, const int& width, const RGB& background_colour, PPM& image);
-	auto render(const Camera& camera) -> std::vector<RGB>;
+	/*
+		The overloads without a scene render make_default_scene(). The overloads taking a span write into
+		the caller's buffer of camera.width * camera.height pixels and leave RenderResult::pixels empty,
+		pixels outside the requested regions are left as they were. They accept any of the framebuffer formats
+		in pixel_formats.h, so a render only ever holds the final image at the size of that format.
+	*/
+	auto render(const Camera& camera, const RenderControl& control = {}) -> RenderResult;
+	auto render(const Camera& camera, const Scene& objects, const RenderControl& control = {}) -> RenderResult;
+	template<typename Pixel>
+	auto render(const Camera& camera, const Scene& objects, std::span<Pixel> pixels, const RenderControl& control = {}) -> RenderResult;
+	auto render(const Camera& camera, const ProgressiveSettings& settings, const RenderControl& control = {}) -> RenderResult;
+	auto render(const Camera& camera, const Scene& objects, const ProgressiveSettings& settings, const RenderControl& control = {}) -> RenderResult;
+	template<typename Pixel>
+	auto render(const Camera& camera, const Scene& objects, const ProgressiveSettings& settings, std::span<Pixel> pixels, const RenderControl& control = {}) -> RenderResult;
+
+	template<typename Pixel>
+	auto render(const Camera& camera, const Scene& objects, std::vector<Pixel>& pixels, const RenderControl& control = {}) {
+		return render(camera, objects, std::span<Pixel>(pixels), control);
+	}
+	template<typename Pixel>
+	auto render(const Camera& camera, const Scene& objects, const ProgressiveSettings& settings, std::vector<Pixel>& pixels, const RenderControl& control = {}) {
+		return render(camera, objects, settings, std::span<Pixel>(pixels), control);
+	}
 
 }
 
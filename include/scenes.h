@@ -0,0 +1,137 @@
+#ifndef _SCENES_H_
+#define _SCENES_H_
+
+#include <array>
+#include <random>
+#include <string_view>
+#include <cstdlib>
+#include <string>
+#include <memory>
+#include <optional>
+
+#include "raytracer.h"
+#include "texture.h"
+
+// Reference scenes shared by the benchmarks and the golden image tests.
+namespace raytracer::scenes
+{
+	inline auto make_dense_spheres() -> Scene {
+		Scene objects;
+		std::mt19937 rand_engine{ 7 };
+		std::uniform_real_distribution<float> get_x(-2.0f, 2.0f);
+		std::uniform_real_distribution<float> get_y(-0.2f, 1.0f);
+		std::uniform_real_distribution<float> get_z(-3.0f, -0.8f);
+		std::uniform_real_distribution<float> get_radius(0.03f, 0.1f);
+		std::uniform_int_distribution<int> get_channel(30, 230);
+
+		for (size_t i = 0; i < 400; ++i) {
+			objects.make_sphere(
+				pt3{ get_x(rand_engine), get_y(rand_engine), get_z(rand_engine) },
+				get_radius(rand_engine),
+				RGB{ get_channel(rand_engine), get_channel(rand_engine), get_channel(rand_engine) });
+		}
+		objects.make_sphere(pt3{ 0,-100.2,-1 }, 100);
+		objects.point_lights.emplace_back(-1, 10, 0);
+		return objects;
+	}
+
+	inline auto make_many_lights() -> Scene {
+		auto objects = make_default_scene();
+		objects.point_lights.clear();
+		std::srand(7);
+		objects.make_light(pt3{ -1, 10, 0 });
+		objects.make_light(pt3{ 3, 6, -1 });
+		objects.make_light(pt3{ -4, 4, 1 });
+		objects.make_light(pt3{ 0, 8, 4 });
+		return objects;
+	}
+
+	// A floor and ceiling sphere facing each other, so most paths bounce until RAY_DEPTH.
+	inline auto make_deep_bounces() -> Scene {
+		auto objects = make_default_scene();
+		objects.make_sphere(pt3{ 0, 100.8, -1 }, 100, RGB{ 180,180,180 });
+		objects.point_lights.clear();
+		objects.point_lights.emplace_back(-1, 0.5, 0);
+		return objects;
+	}
+
+	// A mirror, a clear and a frosted glass sphere in front of diffuse ones they reflect and refract.
+	inline auto make_mirrors_and_glass() -> Scene {
+		Scene objects;
+		objects.make_sphere(pt3{ -0.85, 0.1, -1.2 }, 0.3, Metal{ 0.9f });
+		objects.make_sphere(pt3{ 0.0, 0.05, -1.0 }, 0.25, Glass{ 0.0f, 1.5f });
+		objects.make_sphere(pt3{ 0.7, 0.1, -1.2 }, 0.3, Glass{ 0.1f, 1.5f });
+		objects.make_sphere(pt3{ 0.0, 0.1, -2.2 }, 0.3, RGB{ 200,50,50 });
+		objects.make_sphere(pt3{ -0.2, -0.1, -0.7 }, 0.1, RGB{ 50,200,50 });
+		objects.make_sphere(pt3{ 1.0, 0.2, -2.4 }, 0.4, RGB{ 220,180,40 });
+		objects.make_sphere(pt3{ 0,-100.2,-1 }, 100);
+		objects.point_lights.emplace_back(-1, 10, 0);
+		return objects;
+	}
+
+	// A checker floor under marble, noise and gradient spheres, all procedural.
+	inline auto make_procedural() -> Scene {
+		Scene objects;
+		objects.make_sphere(pt3{ -0.7, 0.1, -1.2 }, 0.3, ProceduralTexture{ Pattern::marble, RGB{ 230,230,220 }, RGB{ 60,60,90 }, 4 });
+		objects.make_sphere(pt3{ 0.0, 0.1, -1.0 }, 0.3, ProceduralTexture{ Pattern::noise, RGB{ 200,120,40 }, RGB{ 60,30,10 }, 8 });
+		objects.make_sphere(pt3{ 0.7, 0.1, -1.2 }, 0.3, ProceduralTexture{ Pattern::gradient, RGB{ 200,220,255 }, RGB{ 40,80,200 }, 1 / 0.3f });
+		objects.make_sphere(pt3{ 0,-100.2,-1 }, 100, ProceduralTexture{ Pattern::checker, RGB{ 220,220,220 }, RGB{ 40,40,40 }, 4 });
+		objects.point_lights.emplace_back(-1, 10, 0);
+		return objects;
+	}
+
+	// The default scene with the texture on its row of small spheres, empty when the texture can't be read.
+	inline auto make_textured(const std::string& texture_path, std::shared_ptr<TextureCache> textures = {}) -> std::optional<Scene> {
+		Scene objects;
+		objects.textures = std::move(textures);
+		const auto texture = objects.load_texture(texture_path);
+		if (!texture.has_value()) {
+			return {};
+		}
+		for (const auto& x : { 0.0f, 0.5f, -0.5f, 1.0f, -1.0f, 1.5f, -1.5f, 2.0f, -2.0f }) {
+			objects.make_sphere(pt3{ x, 0, -0.5 }, 0.2, *texture);
+		}
+		objects.make_sphere(pt3{ 0, 0, 2 }, 1);
+		objects.make_sphere(pt3{ 0,-100.2,-1 }, 100);
+		objects.point_lights.emplace_back(-1, 10, 0);
+		return objects;
+	}
+
+	struct NamedScene {
+		std::string_view name;
+		Scene(*make_scene)();
+	};
+
+	inline const auto REFERENCE_SCENES = std::array{
+		NamedScene{ "default", make_default_scene },
+		NamedScene{ "dense_spheres", make_dense_spheres },
+		NamedScene{ "many_lights", make_many_lights },
+		NamedScene{ "deep_bounces", make_deep_bounces },
+		NamedScene{ "mirrors_and_glass", make_mirrors_and_glass },
+		NamedScene{ "procedural", make_procedural },
+	};
+
+	// What a scene is built from, so another process can build the same one. A texture path makes the textured scene, otherwise the reference scene is used.
+	struct SceneDescription {
+		std::string reference_scene = "default";
+		std::string texture_path;
+		size_t texture_cache_mb = 64;
+		std::string texture_cache_directory;
+	};
+
+	// Empty when there is no reference scene of that name or the texture can't be read.
+	inline auto make_scene(const SceneDescription& description) -> std::optional<Scene> {
+		if (!description.texture_path.empty()) {
+			return make_textured(description.texture_path,
+				std::make_shared<TextureCache>(description.texture_cache_mb << 20, description.texture_cache_directory));
+		}
+		for (const auto& scene : REFERENCE_SCENES) {
+			if (scene.name == description.reference_scene) {
+				return scene.make_scene();
+			}
+		}
+		return {};
+	}
+}
+
+#endif // _SCENES_H_
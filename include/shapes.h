@@ -3,6 +3,7 @@
 #include <math.h>
 
 #include <utility>
+#include <algorithm>
 #include <optional>
 #include "linearAlgebra.h"
 
@@ -10,18 +11,18 @@ namespace shapes
 {
 	struct Sphere
 	{
-		const pt3   position;
-		const float radius;
-		const float radius_squared;
-		Sphere(const float& x, const float& y, const float& z, const float& r)
-			: position({x,y,z}), radius(r), radius_squared(r*r)
+		const pt3  position;
+		const Real radius;
+		const Real radius_squared;
+		Sphere(const Real& x, const Real& y, const Real& z, const Real& r)
+			: position(x, y, z), radius(r), radius_squared(r*r)
 		{}
-		Sphere(const pt3& center_point, const float& r)
+		Sphere(const pt3& center_point, const Real& r)
 			: position(center_point), radius(r), radius_squared(r*r)
 		{}
 	};
 
-	inline auto distance_from_center(const Sphere& s, const pt3& p) -> float {
+	inline auto distance_from_center(const Sphere& s, const pt3& p) -> Real {
 		return sqrt(pow(p.x - s.position.x, 2) + pow(p.y - s.position.y, 2) + pow(p.z - s.position.z, 2));
 	}
 	inline auto is_on_surface(const Sphere& s, const pt3& p) -> bool {
@@ -52,8 +53,8 @@ namespace shapes
 		else [[unlikely]]
 		{
 			//Quadratic Formula
-			const auto t1 = float((-B - sqrt(D)) / (A));
-			const auto t2 = float((-B + sqrt(D)) / (A));
+			const auto t1 = Real((-B - sqrt(D)) / (A));
+			const auto t2 = Real((-B + sqrt(D)) / (A));
 			//Want closet value to the camera.
 			const auto t = (t1 < t2) ? t1 : t2;
 		
@@ -64,7 +65,11 @@ namespace shapes
 			};
 		}
 	}
-	inline auto get_hit_t(const Sphere& sphere, const pt3& ray_origin, const vec3& ray_direction) -> std::optional<float> {
+	/*
+		For a large sphere C is the difference of two large squares, which in float loses most of
+		the hit's distance, so scenes with large spheres need the double precision mode.
+	*/
+	inline auto get_hit_t(const Sphere& sphere, const pt3& ray_origin, const vec3& ray_direction) -> std::optional<Real> {
 		//Reference: https://viclw17.github.io/2018/07/16/raytracing-ray-sphere-intersection/
 		const auto sphere_to_origin = vec_from_pts(ray_origin, sphere.position);
 		const auto A = dot_product(ray_direction, ray_direction);
@@ -76,8 +81,8 @@ namespace shapes
 			return {};
 		}
 		else [[unlikely]] {
-			auto t1 = (-B - sqrt(D)) / (2 * A);
-			t1 = round(0, t1);
+			auto t1 = Real((-B - sqrt(D)) / (2 * A));
+			t1 = round<Real>(0, t1, HIT_EPSILON);
 
 			//Want smallest +ve value
 			if (t1>0) [[unlikely]] {
@@ -88,7 +93,7 @@ namespace shapes
 			}
 		}
 	}
-	inline auto get_hit_tt(const Sphere& sphere, const pt3& ray_origin, const vec3& ray_direction) -> std::optional<std::pair<float, float>> {
+	inline auto get_hit_tt(const Sphere& sphere, const pt3& ray_origin, const vec3& ray_direction) -> std::optional<std::pair<Real, Real>> {
 		//Reference: https://viclw17.github.io/2018/07/16/raytracing-ray-sphere-intersection/
 		const auto sphere_to_origin = vec_from_pts(ray_origin, sphere.position);
 		const auto A = dot_product(ray_direction, ray_direction);
@@ -97,8 +102,8 @@ namespace shapes
 		const auto D = B * B - (A * C);
 
 		if (D > 0) [[unlikely]] {
-			const auto t1 = (-B + sqrt(D)) / A;
-			const auto t2 = (-B - sqrt(D)) / A;
+			const auto t1 = Real((-B + sqrt(D)) / A);
+			const auto t2 = Real((-B - sqrt(D)) / A);
 			return std::pair{t1,t2};	
 		}
 		else [[likely]] {
@@ -106,10 +111,30 @@ namespace shapes
 		}
 	}
 
-	inline auto get_normal_vec(const Sphere& s, const pt3& point_on_sphere) {
+	// Far intersection, for a ray that starts inside the sphere and has to leave it.
+	inline auto get_exit_t(const Sphere& sphere, const pt3& ray_origin, const vec3& ray_direction) -> Real {
+		const auto sphere_to_origin = vec_from_pts(ray_origin, sphere.position);
+		const auto A = dot_product(ray_direction, ray_direction);
+		const auto B = 2 * dot_product(ray_direction, sphere_to_origin);
+		const auto C = dot_product(sphere_to_origin, sphere_to_origin) - sphere.radius_squared;
+		const auto D = B * B - 4 * A * C;
+		return Real((-B + sqrt(D > 0 ? D : 0)) / (2 * A));
+	}
+
+	inline auto get_normal_vec(const Sphere& s, const pt3& point_on_sphere) -> vec3 {
 		return vec_from_pts(point_on_sphere, s.position);
 	}
 
+	// Longitude and latitude texture coordinates, u wraps around the y axis and v runs from the top pole down.
+	inline auto get_sphere_uv(const Sphere& s, const pt3& point_on_sphere) -> std::pair<float, float> {
+		const auto n = get_normal_vec(s, point_on_sphere);
+		const auto y = std::clamp(Real(n.j / s.radius), Real(-1), Real(1));
+		return {
+			0.5f + float(atan2(n.k, n.i) / (2 * M_PI)),
+			0.5f - float(asin(y) / M_PI)
+		};
+	}
+
 
 }
 
@@ -0,0 +1,127 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+/*
+	Hot path counters and stage timers, only compiled in when RAYTRACER_STATS is defined.
+	Stages are timed per tile, per progressive pass and per image write, never per ray.
+	Without it every RT_STAT_* macro expands to nothing, and RT_STAT_GET to 0, so release builds pay nothing.
+	Each thread counts into its own thread_local copy, merged into the process totals with
+	RT_STAT_MERGE_THREAD() before the thread exits.
+*/
+
+#include "raytracer_config.h"
+
+#ifdef RAYTRACER_STATS
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+
+namespace stats
+{
+	enum class Counter { primary_rays, bounce_rays, shadow_rays, intersection_tests, samples, allocations, count };
+	enum class Stage { tiles, passes, output, count };
+
+	constexpr std::array<std::string_view, size_t(Counter::count)> COUNTER_NAMES = {
+		"primary_rays", "bounce_rays", "shadow_rays", "intersection_tests", "samples", "allocations"
+	};
+	constexpr std::array<std::string_view, size_t(Stage::count)> STAGE_NAMES = {
+		"tiles", "passes", "output"
+	};
+
+	struct Stats {
+		std::array<uint64_t, size_t(Counter::count)> counters{};
+		std::array<uint64_t, size_t(Stage::count)> stage_ns{};
+		std::array<uint64_t, size_t(Stage::count)> stage_calls{};
+
+		auto operator+=(const Stats& other) -> Stats& {
+			for (size_t i = 0; i < counters.size(); ++i) counters[i] += other.counters[i];
+			for (size_t i = 0; i < stage_ns.size(); ++i) stage_ns[i] += other.stage_ns[i];
+			for (size_t i = 0; i < stage_calls.size(); ++i) stage_calls[i] += other.stage_calls[i];
+			return *this;
+		}
+	};
+
+	inline thread_local Stats thread_stats;
+	inline Stats total_stats;
+	inline std::mutex total_stats_mutex;
+
+	inline auto add(const Counter& counter, const uint64_t& amount) {
+		thread_stats.counters[size_t(counter)] += amount;
+	}
+	inline auto get(const Counter& counter) -> uint64_t {
+		return thread_stats.counters[size_t(counter)];
+	}
+
+	class ScopedTimer {
+		const Stage stage_;
+		const std::chrono::steady_clock::time_point start_;
+	public:
+		ScopedTimer(const Stage& stage) : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+		~ScopedTimer() {
+			const auto elapsed = std::chrono::steady_clock::now() - start_;
+			thread_stats.stage_ns[size_t(stage_)] += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+			thread_stats.stage_calls[size_t(stage_)]++;
+		}
+	};
+
+	inline auto merge_thread() {
+		std::lock_guard lock{ total_stats_mutex };
+		total_stats += thread_stats;
+		thread_stats = {};
+	}
+
+	// Merges the calling thread first, so stages timed on the main thread are included.
+	inline auto get_totals() -> Stats {
+		merge_thread();
+		std::lock_guard lock{ total_stats_mutex };
+		return total_stats;
+	}
+
+	inline auto print_summary(std::ostream& out) {
+		const auto totals = get_totals();
+		out << "Stats:\n";
+		for (size_t i = 0; i < totals.counters.size(); ++i) {
+			out << "  " << COUNTER_NAMES[i] << " = " << totals.counters[i] << "\n";
+		}
+		for (size_t i = 0; i < totals.stage_ns.size(); ++i) {
+			out << "  " << STAGE_NAMES[i] << " = " << totals.stage_ns[i] / 1e6 << "ms over "
+				<< totals.stage_calls[i] << " calls (summed over threads)\n";
+		}
+	}
+
+	inline auto print_json(std::ostream& out) {
+		const auto totals = get_totals();
+		out << "{\n  \"counters\": {";
+		for (size_t i = 0; i < totals.counters.size(); ++i) {
+			out << (i ? ", " : " ") << "\"" << COUNTER_NAMES[i] << "\": " << totals.counters[i];
+		}
+		out << " },\n  \"stages\": {";
+		for (size_t i = 0; i < totals.stage_ns.size(); ++i) {
+			out << (i ? "," : "") << "\n    \"" << STAGE_NAMES[i] << "\": { \"ns\": " << totals.stage_ns[i]
+				<< ", \"calls\": " << totals.stage_calls[i] << " }";
+		}
+		out << "\n  }\n}\n";
+	}
+}
+
+#define RT_STAT_CONCAT_(a, b) a##b
+#define RT_STAT_CONCAT(a, b) RT_STAT_CONCAT_(a, b)
+#define RT_STAT_ADD(counter, amount) stats::add(stats::Counter::counter, amount)
+#define RT_STAT_GET(counter) stats::get(stats::Counter::counter)
+#define RT_STAT_TIMER(stage) const stats::ScopedTimer RT_STAT_CONCAT(stat_timer_, __LINE__){ stats::Stage::stage }
+#define RT_STAT_MERGE_THREAD() stats::merge_thread()
+
+#else
+
+#define RT_STAT_ADD(counter, amount)
+#define RT_STAT_GET(counter) uint64_t(0)
+#define RT_STAT_TIMER(stage)
+#define RT_STAT_MERGE_THREAD()
+
+#endif // RAYTRACER_STATS
+
+#endif // _STATS_H_
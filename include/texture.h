@@ -0,0 +1,105 @@
+#ifndef _TEXTURE_H_
+#define _TEXTURE_H_
+
+#include <string>
+#include <cstdint>
+#include <vector>
+#include <array>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <optional>
+#include <atomic>
+#include <filesystem>
+#include <thread>
+
+#include "pixel_formats.h"
+
+namespace raytracer
+{
+	constexpr size_t TEXTURE_TILE_SIZE = 32;
+
+	struct TextureTile {
+		std::array<RGB8, TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE> texels;
+	};
+
+	/*
+		Writes the PPM at image_path as a tiled, MIP-mapped texture file: an "RTTX" header, then every
+		level from full size down to 1x1, each as row-major tiles of TEXTURE_TILE_SIZE squared RGB8 texels.
+		Edge tiles are padded by repeating the last row and column.
+	*/
+	auto make_tiled_texture(const std::string& image_path, const std::string& tiled_path) -> bool;
+
+	/*
+		Image textures read a tile at a time from their tiled files, so only the tiles that are being
+		sampled are held in memory. Resident tiles are capped at max_resident_bytes and the least recently
+		used are evicted first. The cache is split into shards with their own locks, and each render
+		thread remembers the last few tiles it used so most lookups take no lock at all.
+	*/
+	class TextureCache {
+	public:
+		struct Stats {
+			uint64_t lookups = 0;
+			uint64_t tile_loads = 0;
+			uint64_t evictions = 0;
+		};
+
+		// Tiled files are written to cache_directory, or to raytracer_textures in the temporary directory when it is empty.
+		TextureCache(const size_t& max_resident_bytes = size_t(64) << 20, const std::string& cache_directory = {});
+		TextureCache(const TextureCache&) = delete;
+		auto operator=(const TextureCache&) -> TextureCache& = delete;
+
+		// Converts the image to a tiled file in the cache directory unless an up to date one exists. Empty when it can't be read.
+		auto add(const std::string& image_path) -> std::optional<uint32_t>;
+		// Where add() keeps the tiled file of an image, named after the image and a hash of its absolute path.
+		auto get_tiled_path(const std::string& image_path) const -> std::string;
+		// u wraps around and v is clamped. lod 0 is full resolution, fractions blend the two nearest levels.
+		auto sample(const uint32_t& texture, const float& u, const float& v, const float& lod) -> RGBf;
+		// Width in texels of the full resolution level.
+		auto get_width(const uint32_t& texture) const -> size_t;
+		auto get_stats() const -> Stats;
+		auto get_resident_bytes() const -> size_t;
+
+	private:
+		struct Level {
+			size_t width, height, tiles_x, tiles_y;
+			uint64_t offset;
+		};
+		struct TextureFile {
+			std::vector<Level> levels;
+			std::ifstream file;
+			std::mutex file_mutex;
+		};
+		struct Shard {
+			std::mutex mutex;
+			std::list<uint64_t> recency;
+			std::unordered_map<uint64_t, std::pair<std::shared_ptr<const TextureTile>, std::list<uint64_t>::iterator>> tiles;
+			size_t resident_bytes = 0;
+		};
+		// Written only by its own thread, on a cache line of its own.
+		struct alignas(64) LookupCount {
+			std::atomic<uint64_t> lookups = 0;
+		};
+		static constexpr size_t SHARD_COUNT = 16;
+
+		const uint64_t id_;
+		const size_t max_shard_bytes_;
+		const std::filesystem::path cache_directory_;
+		std::vector<std::unique_ptr<TextureFile>> textures_;
+		std::array<Shard, SHARD_COUNT> shards_;
+		mutable std::mutex lookup_counts_mutex_;
+		std::unordered_map<std::thread::id, std::unique_ptr<LookupCount>> lookup_counts_;
+		std::atomic<uint64_t> tile_loads_ = 0;
+		std::atomic<uint64_t> evictions_ = 0;
+
+		auto get_lookup_count() -> LookupCount&;
+		auto get_tile(const uint32_t& texture, const size_t& level, const size_t& tile_index) -> std::shared_ptr<const TextureTile>;
+		auto load_tile(const uint32_t& texture, const size_t& level, const size_t& tile_index) -> std::shared_ptr<const TextureTile>;
+		auto get_texel(const uint32_t& texture, const size_t& level, const size_t& x, const size_t& y) -> RGB8;
+		auto sample_level(const uint32_t& texture, const size_t& level, const float& u, const float& v) -> RGBf;
+	};
+}
+
+#endif // _TEXTURE_H_
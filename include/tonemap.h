@@ -0,0 +1,53 @@
+#ifndef _TONEMAP_H_
+#define _TONEMAP_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <span>
+#include <string_view>
+#include <optional>
+
+#include "raytracer.h"
+
+namespace raytracer
+{
+	/*
+		Curves that bring linear colour into 0 to 1 for display. none clips at 1, reinhard is
+		x / (1 + x) per channel, and aces is Narkowicz's fit of the ACES filmic curve.
+	*/
+	enum class ToneCurve : uint8_t { none, reinhard, aces };
+	constexpr std::array<std::string_view, 3> TONE_CURVE_NAMES = { "none", "reinhard", "aces" };
+
+	constexpr auto parse_tone_curve(std::string_view name) -> std::optional<ToneCurve> {
+		for (size_t i = 0; i < TONE_CURVE_NAMES.size(); ++i) {
+			if (TONE_CURVE_NAMES[i] == name) {
+				return ToneCurve(i);
+			}
+		}
+		return {};
+	}
+
+	// The defaults leave the image as it is, so an unset pass writes the same 8-bit values as write_ppm.
+	struct TonemapSettings {
+		// In stops, each one doubles the colour before the curve.
+		float exposure = 0;
+		ToneCurve curve = ToneCurve::none;
+		// Encodes with the sRGB transfer function, for colour that is linear light rather than display values.
+		bool is_srgb = false;
+		// Adds triangular noise of up to one step before rounding, which breaks up banding in smooth gradients.
+		bool is_dithered = false;
+	};
+
+	/*
+		Applies exposure, the curve, the sRGB encoding and dithering to the image and rounds it to
+		8 bits, into tonemapped, which holds width * height pixels. Rows are split between threads.
+		Wider formats are converted a row at a time to three planes of floats, so every step is a
+		plain loop the compiler vectorises, while 8-bit formats go through a table of the 256 values.
+		The dither pattern is a fixed tile of hashed noise, so an image always gives the same output.
+	*/
+	template<typename Pixel>
+	auto tonemap(const ImageView<Pixel>& image, std::span<RGB8> tonemapped, const TonemapSettings& settings = {}) -> void;
+}
+
+#endif // _TONEMAP_H_
@@ -0,0 +1,46 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+
+/*
+	Timeline tracer that dumps Chrome trace JSON, viewable in chrome://tracing or ui.perfetto.dev.
+	Each thread records into its own fixed size ring buffer without locking, the oldest events are
+	overwritten once it is full. Buffers are handed back when a thread exits and reused by the next
+	thread, so the render threads of successive passes share the same timeline rows.
+	When tracing is off a ScopedEvent costs one relaxed load.
+*/
+namespace trace
+{
+	constexpr size_t RING_CAPACITY = 1 << 16;
+
+	inline std::atomic<bool> is_enabled{ false };
+
+	auto start() -> void;
+	auto write_chrome_json(const std::string& path) -> bool;
+	auto now_ns() -> uint64_t;
+	auto record(const char* name, const uint64_t& begin_ns, const uint64_t& end_ns, const int64_t& arg) -> void;
+
+	// name must be a string literal, only the pointer is stored.
+	class ScopedEvent {
+		const char* name_;
+		const int64_t arg_;
+		const uint64_t begin_ns_;
+	public:
+		ScopedEvent(const char* name, const int64_t& arg = -1)
+			: name_(name), arg_(arg), begin_ns_(is_enabled.load(std::memory_order_relaxed) ? now_ns() : 0)
+		{}
+		~ScopedEvent() {
+			if (begin_ns_ != 0) [[unlikely]] {
+				record(name_, begin_ns_, now_ns(), arg_);
+			}
+		}
+		ScopedEvent(const ScopedEvent&) = delete;
+		auto operator=(const ScopedEvent&) -> ScopedEvent& = delete;
+	};
+}
+
+#endif // _TRACE_H_
@@ -0,0 +1,49 @@
+#include <array>
+#include <string>
+#include <string_view>
+
+#include "aov.h"
+
+raytracer::AovBuffers::AovBuffers(const AovSet& aovs, const size_t& width, const size_t& height)
+	: enabled(aovs), width(width), height(height)
+{
+	for (size_t i = 0; i < AOV_COUNT; ++i) {
+		if (!enabled.contains(Aov(i))) [[likely]] {
+			continue;
+		}
+		for (size_t channel = 0; channel < get_channel_count(Aov(i)); ++channel) {
+			planes[i][channel].assign(width * height, 0.0f);
+		}
+	}
+}
+
+auto raytracer::AovBuffers::get_channels() const -> std::vector<ImageChannel>
+{
+	return get_channels(enabled);
+}
+
+auto raytracer::AovBuffers::get_channels(const AovSet& aovs) const -> std::vector<ImageChannel>
+{
+	constexpr std::array<std::string_view, 3> COLOUR_CHANNELS = { "R", "G", "B" };
+	constexpr std::array<std::string_view, 3> VECTOR_CHANNELS = { "X", "Y", "Z" };
+	std::vector<ImageChannel> channels;
+	for (size_t i = 0; i < AOV_COUNT; ++i) {
+		const auto aov = Aov(i);
+		if (!enabled.contains(aov) || !aovs.contains(aov)) {
+			continue;
+		}
+		if (aov == Aov::depth) {
+			channels.push_back(ImageChannel{ "Z", plane(aov, 0) });
+			continue;
+		}
+		if (aov == Aov::object_id) {
+			channels.push_back(ImageChannel{ "object_id.id", plane(aov, 0) });
+			continue;
+		}
+		const auto& names = aov == Aov::normal ? VECTOR_CHANNELS : COLOUR_CHANNELS;
+		for (size_t channel = 0; channel < 3; ++channel) {
+			channels.push_back(ImageChannel{ std::string(AOV_NAMES[i]) + "." + std::string(names[channel]), plane(aov, channel) });
+		}
+	}
+	return channels;
+}
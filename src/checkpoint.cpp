@@ -0,0 +1,133 @@
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <array>
+
+#include "checkpoint.h"
+#include "trace.h"
+
+constexpr std::array<char, 4> CHECKPOINT_MAGIC = { 'R', 'T', 'C', 'K' };
+constexpr uint32_t CHECKPOINT_VERSION = 1;
+
+inline auto write_raw(std::ofstream& file, const auto& value) {
+	file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+inline auto write_raw(std::ofstream& file, const auto& values, const size_t& count) {
+	file.write(reinterpret_cast<const char*>(values.data()), sizeof(values[0]) * count);
+}
+inline auto read_raw(std::ifstream& file, auto& value) {
+	file.read(reinterpret_cast<char*>(&value), sizeof(value));
+}
+inline auto read_raw(std::ifstream& file, auto& values, const size_t& count) {
+	file.read(reinterpret_cast<char*>(values.data()), sizeof(values[0]) * count);
+}
+
+/*
+	Layout: magic, version, width, height, seed, then the colour sums, luminance square sums
+	and sample counts for every pixel. Written to a temporary file and renamed over the old
+	checkpoint so a crash mid-write never leaves a torn file behind.
+*/
+auto raytracer::write_checkpoint(const std::string& path, const Checkpoint& checkpoint) -> bool
+{
+	const auto temp_path = path + ".tmp";
+	const size_t pixel_count = size_t(checkpoint.width) * checkpoint.height;
+	{
+		std::ofstream file{ temp_path, std::ios::binary | std::ios::trunc };
+		write_raw(file, CHECKPOINT_MAGIC);
+		write_raw(file, CHECKPOINT_VERSION);
+		write_raw(file, checkpoint.width);
+		write_raw(file, checkpoint.height);
+		write_raw(file, checkpoint.seed);
+		write_raw(file, checkpoint.accumulator.colour_sum, pixel_count);
+		write_raw(file, checkpoint.accumulator.luminance_sq_sum, pixel_count);
+		write_raw(file, checkpoint.accumulator.sample_count, pixel_count);
+		if (!file.good()) [[unlikely]] {
+			return false;
+		}
+	}
+	return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+auto raytracer::read_checkpoint(const std::string& path) -> std::optional<Checkpoint>
+{
+	std::ifstream file{ path, std::ios::binary };
+	std::array<char, 4> magic{};
+	uint32_t version = 0;
+	Checkpoint checkpoint{ 0, 0, 0, Accumulator{ 0 } };
+
+	read_raw(file, magic);
+	read_raw(file, version);
+	if (!file.good() || magic != CHECKPOINT_MAGIC || version != CHECKPOINT_VERSION) {
+		return {};
+	}
+	read_raw(file, checkpoint.width);
+	read_raw(file, checkpoint.height);
+	read_raw(file, checkpoint.seed);
+	if (!file.good()) {
+		return {};
+	}
+
+	// The header is not trusted to size the buffers, a truncated or corrupt file must not allocate more than it holds.
+	const auto data_begin = file.tellg();
+	file.seekg(0, std::ios::end);
+	const auto data_size = uint64_t(file.tellg() - data_begin);
+	file.seekg(data_begin);
+	constexpr uint64_t RECORD_SIZE = sizeof(RGBf) + sizeof(float) + sizeof(uint32_t);
+	const uint64_t pixel_count = uint64_t(checkpoint.width) * checkpoint.height;
+	if (!file.good() || pixel_count > data_size / RECORD_SIZE || pixel_count * RECORD_SIZE != data_size) {
+		return {};
+	}
+	checkpoint.accumulator = Accumulator{ pixel_count };
+	read_raw(file, checkpoint.accumulator.colour_sum, pixel_count);
+	read_raw(file, checkpoint.accumulator.luminance_sq_sum, pixel_count);
+	read_raw(file, checkpoint.accumulator.sample_count, pixel_count);
+	if (!file.good()) {
+		return {};
+	}
+	return checkpoint;
+}
+
+raytracer::CheckpointWriter::CheckpointWriter(const std::string& path)
+	: path_(path), thread_(&CheckpointWriter::write_loop, this)
+{}
+
+raytracer::CheckpointWriter::~CheckpointWriter()
+{
+	{
+		std::lock_guard lock{ mutex_ };
+		is_stopping_ = true;
+	}
+	has_work_.notify_one();
+	thread_.join();
+}
+
+auto raytracer::CheckpointWriter::submit(Checkpoint checkpoint) -> void
+{
+	{
+		std::lock_guard lock{ mutex_ };
+		pending_ = std::move(checkpoint);
+	}
+	has_work_.notify_one();
+}
+
+auto raytracer::CheckpointWriter::write_loop() -> void
+{
+	std::unique_lock lock{ mutex_ };
+	while (true) {
+		has_work_.wait(lock, [&]() { return pending_.has_value() || is_stopping_; });
+		if (!pending_.has_value()) {
+			return;
+		}
+		auto checkpoint = std::move(*pending_);
+		pending_.reset();
+
+		lock.unlock();
+		trace::ScopedEvent event{ "checkpoint write" };
+		if (!write_checkpoint(path_, checkpoint)) [[unlikely]] {
+			std::cout << "CHECKPOINT ERROR:\tFailed to write " << path_ << "\n";
+		}
+		lock.lock();
+	}
+}
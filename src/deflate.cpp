@@ -0,0 +1,354 @@
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <queue>
+#include <span>
+#include <algorithm>
+#include <functional>
+
+#include "deflate.h"
+
+constexpr size_t WINDOW_SIZE = 32768;
+constexpr size_t MIN_MATCH = 3;
+constexpr size_t MAX_MATCH = 258;
+constexpr size_t MAX_CHAIN = 32;
+constexpr uint32_t HASH_BITS = 15;
+// Tokens per block, each block gets Huffman codes fitted to its own symbols.
+constexpr size_t BLOCK_TOKENS = 1 << 16;
+
+constexpr size_t END_OF_BLOCK = 256;
+constexpr size_t LITERAL_LENGTH_CODES = 286;
+constexpr size_t DISTANCE_CODES = 30;
+constexpr size_t CODE_LENGTH_CODES = 19;
+constexpr size_t MAX_CODE_BITS = 15;
+constexpr size_t MAX_CODE_LENGTH_BITS = 7;
+
+constexpr std::array<uint16_t, 29> LENGTH_BASE = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+constexpr std::array<uint8_t, 29> LENGTH_EXTRA = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+constexpr std::array<uint16_t, 30> DISTANCE_BASE = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+constexpr std::array<uint8_t, 30> DISTANCE_EXTRA = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+constexpr std::array<uint8_t, CODE_LENGTH_CODES> CODE_LENGTH_ORDER = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+
+// A literal byte when distance is 0, otherwise a match of length bytes that many bytes back.
+struct Token {
+	uint16_t length;
+	uint16_t distance;
+};
+
+// Deflate packs bits from the least significant end of each byte.
+class BitWriter {
+	std::vector<uint8_t>& out_;
+	uint64_t buffer_ = 0;
+	uint32_t count_ = 0;
+public:
+	BitWriter(std::vector<uint8_t>& out) : out_(out) {}
+	auto write(const uint32_t& bits, const uint32_t& count) {
+		buffer_ |= uint64_t(bits) << count_;
+		count_ += count;
+		while (count_ >= 8) {
+			out_.push_back(uint8_t(buffer_));
+			buffer_ >>= 8;
+			count_ -= 8;
+		}
+	}
+	auto flush() {
+		if (count_ > 0) {
+			out_.push_back(uint8_t(buffer_));
+		}
+		buffer_ = 0;
+		count_ = 0;
+	}
+};
+
+inline auto get_length_code(const size_t& length) {
+	return size_t(std::upper_bound(LENGTH_BASE.begin(), LENGTH_BASE.end(), length) - LENGTH_BASE.begin()) - 1;
+}
+inline auto get_distance_code(const size_t& distance) {
+	return size_t(std::upper_bound(DISTANCE_BASE.begin(), DISTANCE_BASE.end(), distance) - DISTANCE_BASE.begin()) - 1;
+}
+
+inline auto hash3(const uint8_t* p) {
+	return ((uint32_t(p[0]) << 16 | uint32_t(p[1]) << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Greedy LZ77, every position is added to the hash chains so later matches can start inside earlier ones.
+auto find_tokens(std::span<const uint8_t> data) -> std::vector<Token>
+{
+	std::vector<Token> tokens;
+	std::vector<int32_t> head(size_t(1) << HASH_BITS, -1);
+	std::vector<int32_t> previous(data.size(), -1);
+	const auto insert = [&](const size_t& position) {
+		if (position + MIN_MATCH <= data.size()) {
+			const auto hash = hash3(data.data() + position);
+			previous[position] = head[hash];
+			head[hash] = int32_t(position);
+		}
+	};
+
+	for (size_t position = 0; position < data.size();) {
+		size_t best_length = 0;
+		size_t best_distance = 0;
+		if (position + MIN_MATCH <= data.size()) {
+			const auto max_length = std::min(MAX_MATCH, data.size() - position);
+			auto candidate = head[hash3(data.data() + position)];
+			for (size_t chain = 0; candidate >= 0 && position - candidate <= WINDOW_SIZE && chain < MAX_CHAIN; ++chain) {
+				// A candidate can only beat the best match if it also matches the byte just past it.
+				if (best_length > 0 && (best_length >= max_length || data[candidate + best_length] != data[position + best_length])) {
+					candidate = previous[candidate];
+					continue;
+				}
+				size_t length = 0;
+				while (length < max_length && data[candidate + length] == data[position + length]) {
+					++length;
+				}
+				if (length > best_length) {
+					best_length = length;
+					best_distance = position - candidate;
+					if (length == max_length) {
+						break;
+					}
+				}
+				candidate = previous[candidate];
+			}
+		}
+		if (best_length < MIN_MATCH) {
+			tokens.push_back(Token{ data[position], 0 });
+			insert(position);
+			++position;
+			continue;
+		}
+		tokens.push_back(Token{ uint16_t(best_length), uint16_t(best_distance) });
+		for (size_t i = 0; i < best_length; ++i) {
+			insert(position + i);
+		}
+		position += best_length;
+	}
+	return tokens;
+}
+
+/*
+	Huffman code lengths for the frequencies, none longer than max_bits. When the tree is too deep
+	the frequencies are halved and it is rebuilt, which flattens it. A lone symbol gets a partner so
+	the code is always complete, which every inflate accepts.
+*/
+auto get_code_lengths(std::span<const uint32_t> frequencies, const size_t& max_bits) -> std::vector<uint8_t>
+{
+	std::vector<uint8_t> lengths(frequencies.size(), 0);
+	std::vector<uint32_t> scaled(frequencies.begin(), frequencies.end());
+	const auto used = size_t(std::count_if(scaled.begin(), scaled.end(), [](const auto& f) { return f > 0; }));
+	if (used < 2) {
+		const auto symbol = size_t(std::find_if(scaled.begin(), scaled.end(), [](const auto& f) { return f > 0; }) - scaled.begin());
+		lengths[symbol < lengths.size() ? symbol : 0] = 1;
+		lengths[symbol == 0 || symbol == lengths.size() ? 1 : 0] = 1;
+		return lengths;
+	}
+
+	while (true) {
+		using Entry = std::pair<uint64_t, int32_t>;
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+		std::vector<int32_t> parent(2 * scaled.size(), -1);
+		for (size_t i = 0; i < scaled.size(); ++i) {
+			if (scaled[i] > 0) {
+				queue.emplace(scaled[i], int32_t(i));
+			}
+		}
+		auto next_node = int32_t(scaled.size());
+		while (queue.size() > 1) {
+			const auto [weight_a, a] = queue.top();
+			queue.pop();
+			const auto [weight_b, b] = queue.top();
+			queue.pop();
+			parent[a] = next_node;
+			parent[b] = next_node;
+			queue.emplace(weight_a + weight_b, next_node++);
+		}
+		// Parents are always created after their children, so depths can be filled from the root down.
+		std::vector<uint32_t> depth(next_node, 0);
+		for (auto node = next_node - 2; node >= 0; --node) {
+			if (parent[node] >= 0) {
+				depth[node] = depth[parent[node]] + 1;
+			}
+		}
+		const auto max_depth = *std::max_element(depth.begin(), depth.begin() + scaled.size());
+		if (max_depth <= max_bits) {
+			for (size_t i = 0; i < scaled.size(); ++i) {
+				lengths[i] = uint8_t(scaled[i] > 0 ? depth[i] : 0);
+			}
+			return lengths;
+		}
+		for (auto& frequency : scaled) {
+			frequency = frequency > 0 ? (frequency + 1) / 2 : 0;
+		}
+	}
+}
+
+// Canonical codes from the lengths, bit reversed so BitWriter sends them most significant bit first.
+auto get_codes(std::span<const uint8_t> lengths) -> std::vector<uint16_t>
+{
+	std::array<uint16_t, MAX_CODE_BITS + 1> length_count{};
+	for (const auto& length : lengths) {
+		length_count[length]++;
+	}
+	length_count[0] = 0;
+	std::array<uint16_t, MAX_CODE_BITS + 1> next_code{};
+	uint16_t code = 0;
+	for (size_t bits = 1; bits <= MAX_CODE_BITS; ++bits) {
+		code = uint16_t((code + length_count[bits - 1]) << 1);
+		next_code[bits] = code;
+	}
+	std::vector<uint16_t> codes(lengths.size(), 0);
+	for (size_t i = 0; i < lengths.size(); ++i) {
+		if (lengths[i] == 0) {
+			continue;
+		}
+		const auto value = next_code[lengths[i]]++;
+		uint16_t reversed = 0;
+		for (size_t bit = 0; bit < lengths[i]; ++bit) {
+			reversed |= uint16_t(((value >> bit) & 1) << (lengths[i] - 1 - bit));
+		}
+		codes[i] = reversed;
+	}
+	return codes;
+}
+
+// A code length symbol, 16 repeats the previous length and 17 and 18 are runs of zeros.
+struct CodeLengthSymbol {
+	uint8_t symbol;
+	uint8_t extra;
+};
+
+auto encode_code_lengths(std::span<const uint8_t> lengths) -> std::vector<CodeLengthSymbol>
+{
+	std::vector<CodeLengthSymbol> symbols;
+	for (size_t i = 0; i < lengths.size();) {
+		size_t run = 1;
+		while (i + run < lengths.size() && lengths[i + run] == lengths[i]) {
+			++run;
+		}
+		if (lengths[i] == 0 && run >= 11) {
+			run = std::min<size_t>(run, 138);
+			symbols.push_back({ 18, uint8_t(run - 11) });
+		}
+		else if (lengths[i] == 0 && run >= 3) {
+			symbols.push_back({ 17, uint8_t(run - 3) });
+		}
+		else if (lengths[i] != 0 && run >= 4) {
+			run = std::min<size_t>(run, 7);
+			symbols.push_back({ lengths[i], 0 });
+			symbols.push_back({ 16, uint8_t(run - 4) });
+		}
+		else {
+			run = 1;
+			symbols.push_back({ lengths[i], 0 });
+		}
+		i += run;
+	}
+	return symbols;
+}
+
+auto write_block(BitWriter& writer, std::span<const Token> tokens, const bool& is_final)
+{
+	std::array<uint32_t, LITERAL_LENGTH_CODES> literal_frequencies{};
+	std::array<uint32_t, DISTANCE_CODES> distance_frequencies{};
+	for (const auto& token : tokens) {
+		if (token.distance == 0) {
+			literal_frequencies[token.length]++;
+			continue;
+		}
+		literal_frequencies[257 + get_length_code(token.length)]++;
+		distance_frequencies[get_distance_code(token.distance)]++;
+	}
+	literal_frequencies[END_OF_BLOCK] = 1;
+
+	const auto literal_lengths = get_code_lengths(literal_frequencies, MAX_CODE_BITS);
+	const auto distance_lengths = get_code_lengths(distance_frequencies, MAX_CODE_BITS);
+	const auto literal_codes = get_codes(literal_lengths);
+	const auto distance_codes = get_codes(distance_lengths);
+
+	auto literal_count = literal_lengths.size();
+	while (literal_count > 257 && literal_lengths[literal_count - 1] == 0) {
+		--literal_count;
+	}
+	auto distance_count = distance_lengths.size();
+	while (distance_count > 1 && distance_lengths[distance_count - 1] == 0) {
+		--distance_count;
+	}
+	std::vector<uint8_t> all_lengths(literal_lengths.begin(), literal_lengths.begin() + literal_count);
+	all_lengths.insert(all_lengths.end(), distance_lengths.begin(), distance_lengths.begin() + distance_count);
+	const auto length_symbols = encode_code_lengths(all_lengths);
+
+	std::array<uint32_t, CODE_LENGTH_CODES> code_length_frequencies{};
+	for (const auto& symbol : length_symbols) {
+		code_length_frequencies[symbol.symbol]++;
+	}
+	const auto code_length_lengths = get_code_lengths(code_length_frequencies, MAX_CODE_LENGTH_BITS);
+	const auto code_length_codes = get_codes(code_length_lengths);
+	size_t code_length_count = CODE_LENGTH_CODES;
+	while (code_length_count > 4 && code_length_lengths[CODE_LENGTH_ORDER[code_length_count - 1]] == 0) {
+		--code_length_count;
+	}
+
+	writer.write(is_final ? 1 : 0, 1);
+	writer.write(2, 2);
+	writer.write(uint32_t(literal_count - 257), 5);
+	writer.write(uint32_t(distance_count - 1), 5);
+	writer.write(uint32_t(code_length_count - 4), 4);
+	for (size_t i = 0; i < code_length_count; ++i) {
+		writer.write(code_length_lengths[CODE_LENGTH_ORDER[i]], 3);
+	}
+	for (const auto& symbol : length_symbols) {
+		writer.write(code_length_codes[symbol.symbol], code_length_lengths[symbol.symbol]);
+		if (symbol.symbol >= 16) {
+			writer.write(symbol.extra, symbol.symbol == 16 ? 2 : symbol.symbol == 17 ? 3 : 7);
+		}
+	}
+
+	for (const auto& token : tokens) {
+		if (token.distance == 0) {
+			writer.write(literal_codes[token.length], literal_lengths[token.length]);
+			continue;
+		}
+		const auto length_code = get_length_code(token.length);
+		writer.write(literal_codes[257 + length_code], literal_lengths[257 + length_code]);
+		writer.write(uint32_t(token.length - LENGTH_BASE[length_code]), LENGTH_EXTRA[length_code]);
+		const auto distance_code = get_distance_code(token.distance);
+		writer.write(distance_codes[distance_code], distance_lengths[distance_code]);
+		writer.write(uint32_t(token.distance - DISTANCE_BASE[distance_code]), DISTANCE_EXTRA[distance_code]);
+	}
+	writer.write(literal_codes[END_OF_BLOCK], literal_lengths[END_OF_BLOCK]);
+}
+
+inline auto adler32(std::span<const uint8_t> data) {
+	constexpr uint32_t MODULUS = 65521;
+	// The largest run of bytes whose sums cannot overflow 32 bits before the modulus is taken.
+	constexpr size_t MAX_RUN = 5552;
+	uint32_t a = 1;
+	uint32_t b = 0;
+	for (size_t begin = 0; begin < data.size(); begin += MAX_RUN) {
+		const auto end = std::min(begin + MAX_RUN, data.size());
+		for (size_t i = begin; i < end; ++i) {
+			a += data[i];
+			b += a;
+		}
+		a %= MODULUS;
+		b %= MODULUS;
+	}
+	return (b << 16) | a;
+}
+
+auto raytracer::zlib_compress(std::span<const uint8_t> data) -> std::vector<uint8_t>
+{
+	std::vector<uint8_t> out = { 0x78, 0x9c };
+	BitWriter writer(out);
+	const auto tokens = find_tokens(data);
+	for (size_t begin = 0; begin == 0 || begin < tokens.size(); begin += BLOCK_TOKENS) {
+		const auto count = std::min(BLOCK_TOKENS, tokens.size() - begin);
+		write_block(writer, std::span(tokens).subspan(begin, count), begin + count >= tokens.size());
+	}
+	writer.flush();
+	const auto checksum = adler32(data);
+	for (const auto shift : { 24, 16, 8, 0 }) {
+		out.push_back(uint8_t(checksum >> shift));
+	}
+	return out;
+}
@@ -0,0 +1,183 @@
+#include <cmath>
+#include <cstdint>
+#include <bit>
+#include <array>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include "denoise.h"
+#include "trace.h"
+
+// Albedo below this is treated as black, which is not demodulated.
+constexpr float MIN_ALBEDO = 0.01f;
+constexpr std::array<float, 5> B3_SPLINE = { 1 / 16.0f, 1 / 4.0f, 3 / 8.0f, 1 / 4.0f, 1 / 16.0f };
+
+// Three planes instead of interleaved RGBf, so the filter loops only read contiguous floats.
+struct Planes {
+	std::vector<float> r, g, b;
+
+	Planes(const size_t& size) : r(size), g(size), b(size) {}
+	Planes(std::span<const RGBf> pixels) : Planes(pixels.size()) {
+		for (size_t i = 0; i < pixels.size(); ++i) {
+			r[i] = pixels[i].r;
+			g[i] = pixels[i].g;
+			b[i] = pixels[i].b;
+		}
+	}
+};
+
+/*
+	e^-x for x >= 0 to about 1e-4, from the exponent bits and a cubic for the fractional power of two.
+	Unlike std::exp it has no library call, and x is capped by comparing its bits as an integer
+	(ordered like the floats for x >= 0) because a float compare stops the weight loop vectorising.
+*/
+inline auto fast_exp_negative(const float& x) -> float {
+	constexpr auto MAX_X_BITS = std::bit_cast<int32_t>(87.0f);
+	const auto capped = std::bit_cast<float>(std::min(std::bit_cast<int32_t>(x), MAX_X_BITS));
+	const auto power = -capped * 1.442695041f;
+	const auto truncated = int32_t(power);
+	const auto whole = truncated - int32_t(power < float(truncated));
+	const auto fraction = power - float(whole);
+	const auto mantissa = 1 + fraction * (0.6958656f + fraction * (0.2260232f + fraction * 0.0781091f));
+	return std::bit_cast<float>((whole + 127) << 23) * mantissa;
+}
+
+using PlanePointers = std::array<const float*, 3>;
+
+inline auto get_pointers(const Planes& planes) -> PlanePointers {
+	return { planes.r.data(), planes.g.data(), planes.b.data() };
+}
+inline auto get_pointers(const raytracer::PlaneSpans& planes) -> PlanePointers {
+	return { planes[0].data(), planes[1].data(), planes[2].data() };
+}
+
+inline auto squared_distance(const PlanePointers& planes, const size_t& p, const size_t& q) {
+	const auto* r = planes[0];
+	const auto* g = planes[1];
+	const auto* b = planes[2];
+	return (r[p] - r[q]) * (r[p] - r[q]) + (g[p] - g[q]) * (g[p] - g[q]) + (b[p] - b[q]) * (b[p] - b[q]);
+}
+
+inline auto demodulate_factor(const float& albedo) {
+	return albedo > MIN_ALBEDO ? albedo : 1.0f;
+}
+
+inline auto for_each_row_band(const size_t& height, const auto& filter_rows) {
+	const auto thread_count = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, height);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < thread_count; ++i) {
+		threads.emplace_back(filter_rows, height * i / thread_count, height * (i + 1) / thread_count);
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+auto raytracer::denoise(
+	std::span<const RGBf> colour,
+	const PlaneSpans& albedo,
+	const PlaneSpans& normal,
+	const size_t& width,
+	const size_t& height,
+	const DenoiseSettings& settings) -> std::vector<RGBf>
+{
+	trace::ScopedEvent event{ "denoise" };
+	const auto pixel_count = width * height;
+	const auto is_too_small = [&](const PlaneSpans& planes) {
+		return std::any_of(planes.begin(), planes.end(), [&](const auto& plane) { return plane.size() < pixel_count; });
+	};
+	if (colour.size() < pixel_count || is_too_small(albedo) || is_too_small(normal) || pixel_count == 0) [[unlikely]] {
+		return std::vector<RGBf>(colour.begin(), colour.end());
+	}
+
+	const auto albedo_planes = get_pointers(albedo);
+	const auto normal_planes = get_pointers(normal);
+	Planes current(colour.first(pixel_count));
+	Planes next(pixel_count);
+	for (size_t i = 0; i < pixel_count; ++i) {
+		current.r[i] /= demodulate_factor(albedo_planes[0][i]);
+		current.g[i] /= demodulate_factor(albedo_planes[1][i]);
+		current.b[i] /= demodulate_factor(albedo_planes[2][i]);
+	}
+
+	const auto inverse_normal = 1 / (settings.normal_sigma * settings.normal_sigma);
+	const auto inverse_albedo = 1 / (settings.albedo_sigma * settings.albedo_sigma);
+	for (size_t iteration = 0; iteration < settings.iterations; ++iteration) {
+		const auto step = int64_t(1) << iteration;
+		const auto colour_sigma = settings.colour_sigma / float(step);
+		const auto inverse_colour = 1 / (colour_sigma * colour_sigma);
+
+		// Each tap is applied to a whole row at once, so the x loops are the ones that vectorise.
+		for_each_row_band(height, [&](const size_t& row_begin, const size_t& row_end) {
+			std::vector<float> sum_r(width), sum_g(width), sum_b(width), weight_sum(width), weights(width);
+			const auto current_planes = get_pointers(current);
+			const auto* current_r = current.r.data();
+			const auto* current_g = current.g.data();
+			const auto* current_b = current.b.data();
+			for (size_t y = row_begin; y < row_end; ++y) {
+				std::fill(sum_r.begin(), sum_r.end(), 0.0f);
+				std::fill(sum_g.begin(), sum_g.end(), 0.0f);
+				std::fill(sum_b.begin(), sum_b.end(), 0.0f);
+				std::fill(weight_sum.begin(), weight_sum.end(), 0.0f);
+				const auto row = y * width;
+
+				for (int64_t ky = -2; ky <= 2; ++ky) {
+					const auto qy = int64_t(y) + ky * step;
+					if (qy < 0 || qy >= int64_t(height)) {
+						continue;
+					}
+					for (int64_t kx = -2; kx <= 2; ++kx) {
+						const auto offset = kx * step;
+						const auto x_begin = size_t(std::clamp<int64_t>(-offset, 0, int64_t(width)));
+						const auto x_end = size_t(std::clamp<int64_t>(int64_t(width) - offset, 0, int64_t(width)));
+						const auto kernel = B3_SPLINE[ky + 2] * B3_SPLINE[kx + 2];
+						const auto tap_row = size_t(qy * int64_t(width) + offset);
+
+						// One loop per guide and per sum keeps the aliasing checks few enough for the compiler to vectorise.
+						for (size_t x = x_begin; x < x_end; ++x) {
+							weights[x] = squared_distance(current_planes, row + x, tap_row + x) * inverse_colour;
+						}
+						for (size_t x = x_begin; x < x_end; ++x) {
+							weights[x] += squared_distance(normal_planes, row + x, tap_row + x) * inverse_normal;
+						}
+						for (size_t x = x_begin; x < x_end; ++x) {
+							weights[x] += squared_distance(albedo_planes, row + x, tap_row + x) * inverse_albedo;
+						}
+						for (size_t x = x_begin; x < x_end; ++x) {
+							weights[x] = kernel * fast_exp_negative(weights[x]);
+						}
+						for (size_t x = x_begin; x < x_end; ++x) {
+							sum_r[x] += weights[x] * current_r[tap_row + x];
+						}
+						for (size_t x = x_begin; x < x_end; ++x) {
+							sum_g[x] += weights[x] * current_g[tap_row + x];
+						}
+						for (size_t x = x_begin; x < x_end; ++x) {
+							sum_b[x] += weights[x] * current_b[tap_row + x];
+						}
+						for (size_t x = x_begin; x < x_end; ++x) {
+							weight_sum[x] += weights[x];
+						}
+					}
+				}
+				for (size_t x = 0; x < width; ++x) {
+					next.r[row + x] = sum_r[x] / weight_sum[x];
+					next.g[row + x] = sum_g[x] / weight_sum[x];
+					next.b[row + x] = sum_b[x] / weight_sum[x];
+				}
+			}
+		});
+		std::swap(current, next);
+	}
+
+	std::vector<RGBf> denoised(pixel_count);
+	for (size_t i = 0; i < pixel_count; ++i) {
+		denoised[i] = RGBf{
+			current.r[i] * demodulate_factor(albedo_planes[0][i]),
+			current.g[i] * demodulate_factor(albedo_planes[1][i]),
+			current.b[i] * demodulate_factor(albedo_planes[2][i])
+		};
+	}
+	return denoised;
+}
@@ -0,0 +1,459 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <optional>
+#include <numeric>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+
+#include "distributed.h"
+#include "kernel.h"
+
+enum class MessageType : uint32_t { hello, tile, result, shutdown };
+
+struct MessageHeader {
+	MessageType type;
+	uint32_t size;
+};
+struct HelloMessage {
+	int32_t height;
+	int32_t width;
+	float fov_radians;
+	// The options of the render that pick the workers' kernel.
+	uint32_t ray_depth;
+	uint32_t samples_per_pixel;
+	uint32_t sort_by_material;
+	// The scene the workers build, see scenes::SceneDescription.
+	char reference_scene[64];
+	char texture_path[4096];
+	uint64_t texture_cache_mb;
+	char texture_cache_directory[4096];
+};
+struct TileMessage {
+	uint32_t tile_index;
+	uint32_t x_begin, y_begin, x_end, y_end;
+};
+
+// Copies text into a fixed size field of a message, false when it doesn't fit with its terminator.
+template<size_t Size>
+inline auto copy_to_field(const std::string& text, char (&field)[Size]) -> bool {
+	if (text.size() >= Size) [[unlikely]] {
+		return false;
+	}
+	std::memcpy(field, text.c_str(), text.size() + 1);
+	return true;
+}
+template<size_t Size>
+inline auto read_field(const char (&field)[Size]) -> std::string {
+	return std::string(field, strnlen(field, Size));
+}
+
+inline auto send_all(const int& socket, const void* data, size_t size) -> bool {
+	auto bytes = static_cast<const char*>(data);
+	while (size > 0) {
+		const auto sent = send(socket, bytes, size, MSG_NOSIGNAL);
+		if (sent <= 0) [[unlikely]] {
+			return false;
+		}
+		bytes += sent;
+		size -= sent;
+	}
+	return true;
+}
+inline auto receive_all(const int& socket, void* data, size_t size) -> bool {
+	auto bytes = static_cast<char*>(data);
+	while (size > 0) {
+		const auto received = recv(socket, bytes, size, 0);
+		if (received <= 0) [[unlikely]] {
+			return false;
+		}
+		bytes += received;
+		size -= received;
+	}
+	return true;
+}
+
+inline auto send_message(const int& socket, const MessageType& type, const void* payload = nullptr, const uint32_t& size = 0) -> bool {
+	const auto header = MessageHeader{ type, size };
+	return send_all(socket, &header, sizeof(header)) && (size == 0 || send_all(socket, payload, size));
+}
+// The largest message a worker may send, a result for a full tile.
+constexpr size_t MAX_MESSAGE_SIZE = sizeof(uint32_t) + raytracer::TILE_SIZE * raytracer::TILE_SIZE * sizeof(RGB);
+
+inline auto receive_message(const int& socket, std::vector<char>& payload) -> std::optional<MessageType> {
+	MessageHeader header;
+	if (!receive_all(socket, &header, sizeof(header))) {
+		return {};
+	}
+	payload.resize(header.size);
+	if (header.size > 0 && !receive_all(socket, payload.data(), header.size)) {
+		return {};
+	}
+	return header.type;
+}
+
+/*
+	Appends whatever the socket holds to received without waiting for more, so a slow worker or one
+	that sent half a message never holds up the others. False once the worker has disconnected.
+*/
+inline auto receive_available(const int& socket, std::vector<char>& received) -> bool {
+	char buffer[16384];
+	while (true) {
+		const auto count = recv(socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+		if (count > 0) {
+			received.insert(received.end(), buffer, buffer + count);
+			continue;
+		}
+		if (count == 0) {
+			return false;
+		}
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	}
+}
+// Moves the first whole message out of received, empty until all of it has arrived or when it is too big to be one.
+inline auto take_message(std::vector<char>& received, std::vector<char>& payload, bool& is_valid) -> std::optional<MessageType> {
+	MessageHeader header;
+	if (received.size() < sizeof(header)) {
+		return {};
+	}
+	std::memcpy(&header, received.data(), sizeof(header));
+	if (header.size > MAX_MESSAGE_SIZE) [[unlikely]] {
+		is_valid = false;
+		return {};
+	}
+	if (received.size() < sizeof(header) + header.size) {
+		return {};
+	}
+	payload.assign(received.begin() + sizeof(header), received.begin() + sizeof(header) + header.size);
+	received.erase(received.begin(), received.begin() + sizeof(header) + header.size);
+	return header.type;
+}
+
+// Closed on exec, so spawned workers don't inherit the listener or the other workers' connections.
+inline auto set_close_on_exec(const int& socket) {
+	fcntl(socket, F_SETFD, fcntl(socket, F_GETFD) | FD_CLOEXEC);
+	return socket;
+}
+inline auto make_socket() {
+#ifdef SOCK_CLOEXEC
+	return socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+	return set_close_on_exec(socket(AF_UNIX, SOCK_STREAM, 0));
+#endif
+}
+
+inline auto make_address(const std::string& socket_path) {
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+	return address;
+}
+
+inline auto get_worker_executable(const raytracer::distributed::CoordinatorSettings& settings) -> std::optional<std::string> {
+	if (!settings.worker_executable.empty()) {
+		return settings.worker_executable;
+	}
+#ifdef __linux__
+	return "/proc/self/exe";
+#else
+	return {};
+#endif
+}
+
+inline auto spawn_worker(const std::string& executable, const std::string& socket_path) -> pid_t {
+	const auto pid = fork();
+	if (pid == 0) {
+		execlp(executable.c_str(), "raytracer", "--worker", socket_path.c_str(), nullptr);
+		std::cout << "DISTRIBUTED ERROR:\tCould not start worker process " << executable << "\n";
+		_exit(-1);
+	}
+	return pid;
+}
+
+struct WorkerConnection {
+	int socket;
+	std::vector<std::pair<size_t, std::chrono::steady_clock::time_point>> tiles_in_flight;
+	// Bytes of messages that have not fully arrived yet.
+	std::vector<char> received;
+};
+
+template<typename Pixel>
+auto raytracer::distributed::run_coordinator(
+	const Camera& camera,
+	const Scene& scene,
+	const CoordinatorSettings& settings,
+	std::span<Pixel> pixels,
+	const RenderControl& control) -> RenderResult
+{
+	RenderResult result{ {}, make_tiles(camera, control.regions) };
+	result.tile_coverage.resize(result.tiles.size(), 0);
+	result.is_complete = false;
+	if (pixels.size() != size_t(camera.width) * camera.height) [[unlikely]] {
+		std::cout << "DISTRIBUTED ERROR:\tBuffer holds " << pixels.size() << " pixels when it should be: " << camera.width * camera.height << "\n";
+		return result;
+	}
+	for (const auto& region : control.regions) {
+		if (!is_valid_region(camera, region)) [[unlikely]] {
+			std::cout << "DISTRIBUTED ERROR:\tRegion " << region.x_begin << "," << region.y_begin << "," << region.x_end << "," << region.y_end
+				<< " is not inside the " << camera.width << "x" << camera.height << " frame\n";
+			return result;
+		}
+	}
+	auto hello = HelloMessage{ camera.height, camera.width, camera.fov.radians(),
+		uint32_t(control.ray_depth), uint32_t(control.samples_per_pixel), uint32_t(control.sort_by_material) };
+	hello.texture_cache_mb = settings.scene.texture_cache_mb;
+	if (!copy_to_field(settings.scene.reference_scene, hello.reference_scene) || !copy_to_field(settings.scene.texture_path, hello.texture_path)
+		|| !copy_to_field(settings.scene.texture_cache_directory, hello.texture_cache_directory)) [[unlikely]] {
+		std::cout << "DISTRIBUTED ERROR:\tScene description is too long to send to workers\n";
+		return result;
+	}
+	const auto time_render_start = std::chrono::high_resolution_clock::now();
+
+	const auto listener = make_socket();
+	const auto address = make_address(settings.socket_path);
+	unlink(settings.socket_path.c_str());
+	if (bind(listener, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 64) != 0) {
+		std::cout << "DISTRIBUTED ERROR:\tCould not listen on " << settings.socket_path << "\n";
+		close(listener);
+		return result;
+	}
+
+	std::vector<pid_t> local_workers;
+	const auto worker_executable = get_worker_executable(settings);
+	if (settings.spawn_local_workers > 0 && !worker_executable.has_value()) {
+		std::cout << "DISTRIBUTED ERROR:\tNo worker executable to spawn, set CoordinatorSettings::worker_executable\n";
+	}
+	for (size_t i = 0; i < settings.spawn_local_workers && worker_executable.has_value(); ++i) {
+		local_workers.push_back(spawn_worker(*worker_executable, settings.socket_path));
+	}
+	// Spawned workers that exit are reaped as they go, once they all have there is nobody left to wait for.
+	const auto are_local_workers_gone = [&]() {
+		std::erase_if(local_workers, [](const pid_t& pid) { return waitpid(pid, nullptr, WNOHANG) == pid; });
+		return settings.spawn_local_workers > 0 && local_workers.empty();
+	};
+
+	if (!get_kernel_index(control.ray_depth, control.samples_per_pixel, ALL_MATERIALS, false).has_value()) {
+		std::cout << "DISTRIBUTED ERROR:\tNo kernel for a ray depth of " << control.ray_depth << " with " << control.samples_per_pixel
+			<< " samples per pixel, workers fall back to the defaults\n";
+	}
+	std::deque<size_t> queued_tiles(result.tiles.size());
+	std::iota(queued_tiles.begin(), queued_tiles.end(), 0);
+	std::vector<WorkerConnection> workers;
+	std::vector<pollfd> poll_fds;
+	std::vector<char> payload;
+	size_t tiles_done = 0;
+	auto time_last_worker = std::chrono::steady_clock::now();
+
+	auto drop_worker = [&](const size_t& index) {
+		auto& worker = workers[index];
+		std::cout << "Worker Lost, requeueing " << worker.tiles_in_flight.size() << " tiles\n";
+		for (const auto& [tile_index, time_sent] : worker.tiles_in_flight) {
+			if (result.tile_coverage[tile_index] == 0) {
+				queued_tiles.push_front(tile_index);
+			}
+		}
+		close(worker.socket);
+		workers.erase(workers.begin() + index);
+	};
+
+	while (tiles_done < result.tiles.size() && !control.should_stop()) {
+		for (size_t i = 0; i < workers.size(); ++i) {
+			auto& worker = workers[i];
+			while (worker.tiles_in_flight.size() < settings.tiles_in_flight_per_worker && !queued_tiles.empty()) {
+				const auto tile_index = queued_tiles.front();
+				const auto& tile = result.tiles[tile_index];
+				const auto message = TileMessage{
+					uint32_t(tile_index),
+					uint32_t(tile.x_begin), uint32_t(tile.y_begin), uint32_t(tile.x_end), uint32_t(tile.y_end)
+				};
+				if (!send_message(worker.socket, MessageType::tile, &message, sizeof(message))) [[unlikely]] {
+					break;
+				}
+				queued_tiles.pop_front();
+				worker.tiles_in_flight.emplace_back(tile_index, std::chrono::steady_clock::now());
+			}
+		}
+
+		poll_fds.clear();
+		poll_fds.push_back(pollfd{ listener, POLLIN, 0 });
+		for (const auto& worker : workers) {
+			poll_fds.push_back(pollfd{ worker.socket, POLLIN, 0 });
+		}
+		poll(poll_fds.data(), poll_fds.size(), 100);
+
+		const auto time_now = std::chrono::steady_clock::now();
+		for (size_t i = workers.size(); i > 0; --i) {
+			auto& worker = workers[i - 1];
+			const auto revents = poll_fds[i].revents;
+			if (revents & (POLLIN | POLLHUP | POLLERR)) {
+				auto is_valid = receive_available(worker.socket, worker.received);
+				while (const auto type = take_message(worker.received, payload, is_valid)) {
+					if (*type != MessageType::result || payload.size() < sizeof(uint32_t)) [[unlikely]] {
+						is_valid = false;
+						break;
+					}
+					uint32_t tile_index;
+					std::memcpy(&tile_index, payload.data(), sizeof(tile_index));
+					if (tile_index >= result.tiles.size()) [[unlikely]] {
+						is_valid = false;
+						break;
+					}
+					const auto& tile = result.tiles[tile_index];
+					const auto tile_width = tile.x_end - tile.x_begin;
+					if (payload.size() != sizeof(tile_index) + tile_width * (tile.y_end - tile.y_begin) * sizeof(RGB)) [[unlikely]] {
+						is_valid = false;
+						break;
+					}
+					const auto* tile_pixels = reinterpret_cast<const RGB*>(payload.data() + sizeof(tile_index));
+
+					if (result.tile_coverage[tile_index] == 0) {
+						for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+							convert_pixels(
+								std::span<const RGB>(tile_pixels + (y - tile.y_begin) * tile_width, tile_width),
+								pixels.subspan(y * camera.width + tile.x_begin, tile_width));
+						}
+						result.tile_coverage[tile_index]++;
+						tiles_done++;
+					}
+					std::erase_if(worker.tiles_in_flight, [&](const auto& in_flight) { return in_flight.first == tile_index; });
+				}
+				if (!is_valid) [[unlikely]] {
+					drop_worker(i - 1);
+				}
+			}
+			else if (!worker.tiles_in_flight.empty() && time_now - worker.tiles_in_flight.front().second > settings.tile_timeout) [[unlikely]] {
+				drop_worker(i - 1);
+			}
+		}
+
+		if (poll_fds[0].revents & POLLIN) {
+			const auto connection = accept(listener, nullptr, nullptr);
+			if (connection >= 0 && send_message(set_close_on_exec(connection), MessageType::hello, &hello, sizeof(hello))) {
+				std::cout << "Worker Connected\n";
+				workers.push_back(WorkerConnection{ connection });
+			}
+		}
+
+		// Without any worker for a tile timeout, or once every spawned one has exited, the rest is rendered here.
+		if (!workers.empty()) {
+			time_last_worker = time_now;
+		}
+		else if (tiles_done < result.tiles.size() && (are_local_workers_gone() || time_now - time_last_worker > settings.tile_timeout)) [[unlikely]] {
+			std::cout << "No Workers Left, rendering the remaining " << queued_tiles.size() << " tiles locally\n";
+			auto local_control = control;
+			local_control.regions.clear();
+			for (const auto& tile_index : queued_tiles) {
+				local_control.regions.push_back(result.tiles[tile_index]);
+			}
+			local_control.aovs = {};
+			local_control.denoise.reset();
+			local_control.pixel_cost = PixelCost::none;
+			if (render(camera, scene, pixels, local_control).is_complete) {
+				for (const auto& tile_index : queued_tiles) {
+					result.tile_coverage[tile_index]++;
+				}
+				tiles_done += queued_tiles.size();
+				queued_tiles.clear();
+			}
+			break;
+		}
+	}
+	result.is_complete = tiles_done == result.tiles.size();
+	result.render_time = std::chrono::high_resolution_clock::now() - time_render_start;
+
+	for (const auto& worker : workers) {
+		send_message(worker.socket, MessageType::shutdown);
+		close(worker.socket);
+	}
+	close(listener);
+	unlink(settings.socket_path.c_str());
+	for (const auto& pid : local_workers) {
+		waitpid(pid, nullptr, 0);
+	}
+	return result;
+}
+
+auto raytracer::distributed::run_coordinator(
+	const Camera& camera,
+	const Scene& scene,
+	const CoordinatorSettings& settings,
+	const RenderControl& control) -> RenderResult
+{
+	std::vector<RGB> pixels(camera.height * camera.width, RGB{ 0,0,0 });
+	auto result = run_coordinator(camera, scene, settings, std::span<RGB>(pixels), control);
+	result.pixels = std::move(pixels);
+	return result;
+}
+
+auto raytracer::distributed::run_worker(const std::string& socket_path) -> bool
+{
+	const auto connection = make_socket();
+	const auto address = make_address(socket_path);
+
+	auto is_connected = false;
+	for (auto attempt = 0; attempt < 50 && !is_connected; ++attempt) {
+		is_connected = connect(connection, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+		if (!is_connected) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+	}
+	std::vector<char> payload;
+	if (!is_connected || receive_message(connection, payload) != MessageType::hello || payload.size() != sizeof(HelloMessage)) {
+		std::cout << "DISTRIBUTED ERROR:\tCould not reach coordinator at " << socket_path << "\n";
+		close(connection);
+		return false;
+	}
+
+	HelloMessage hello;
+	std::memcpy(&hello, payload.data(), sizeof(hello));
+	const auto camera = Camera{ hello.height, hello.width, hello.fov_radians };
+	const auto description = scenes::SceneDescription{
+		read_field(hello.reference_scene), read_field(hello.texture_path), size_t(hello.texture_cache_mb), read_field(hello.texture_cache_directory) };
+	const auto objects = scenes::make_scene(description);
+	if (!objects.has_value()) {
+		std::cout << "DISTRIBUTED ERROR:\tCould not build the coordinator's scene " << (description.texture_path.empty() ? description.reference_scene : description.texture_path) << "\n";
+		close(connection);
+		return false;
+	}
+	RenderControl control;
+	control.ray_depth = hello.ray_depth;
+	control.samples_per_pixel = hello.samples_per_pixel;
+	control.sort_by_material = hello.sort_by_material != 0;
+
+	std::vector<char> reply;
+	while (receive_message(connection, payload) == MessageType::tile && payload.size() == sizeof(TileMessage)) {
+		TileMessage message;
+		std::memcpy(&message, payload.data(), sizeof(message));
+		const auto tile = Tile{ message.x_begin, message.y_begin, message.x_end, message.y_end };
+		const auto pixels = render_tile(camera, *objects, tile, control);
+
+		reply.resize(sizeof(message.tile_index) + pixels.size() * sizeof(RGB));
+		std::memcpy(reply.data(), &message.tile_index, sizeof(message.tile_index));
+		std::memcpy(reply.data() + sizeof(message.tile_index), pixels.data(), pixels.size() * sizeof(RGB));
+		if (!send_message(connection, MessageType::result, reply.data(), uint32_t(reply.size()))) {
+			break;
+		}
+	}
+	close(connection);
+	return true;
+}
+
+template auto raytracer::distributed::run_coordinator(const Camera&, const Scene&, const CoordinatorSettings&, std::span<RGB>, const RenderControl&) -> RenderResult;
+template auto raytracer::distributed::run_coordinator(const Camera&, const Scene&, const CoordinatorSettings&, std::span<RGB8>, const RenderControl&) -> RenderResult;
+template auto raytracer::distributed::run_coordinator(const Camera&, const Scene&, const CoordinatorSettings&, std::span<RGBA8>, const RenderControl&) -> RenderResult;
+template auto raytracer::distributed::run_coordinator(const Camera&, const Scene&, const CoordinatorSettings&, std::span<RGB16>, const RenderControl&) -> RenderResult;
+template auto raytracer::distributed::run_coordinator(const Camera&, const Scene&, const CoordinatorSettings&, std::span<RGBh>, const RenderControl&) -> RenderResult;
+template auto raytracer::distributed::run_coordinator(const Camera&, const Scene&, const CoordinatorSettings&, std::span<RGBf>, const RenderControl&) -> RenderResult;
@@ -0,0 +1,247 @@
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "exr.h"
+#include "deflate.h"
+#include "pixel_formats.h"
+#include "trace.h"
+
+constexpr uint32_t EXR_MAGIC = 20000630;
+constexpr uint32_t EXR_VERSION = 2;
+constexpr int32_t EXR_HALF = 1;
+constexpr int32_t EXR_FLOAT = 2;
+constexpr size_t MIN_RUN_LENGTH = 3;
+constexpr size_t MAX_RUN_LENGTH = 127;
+
+// EXR is little endian throughout, like every platform the renderer is built for.
+inline auto append_raw(std::vector<char>& bytes, const auto& value) {
+	const auto* begin = reinterpret_cast<const char*>(&value);
+	bytes.insert(bytes.end(), begin, begin + sizeof(value));
+}
+inline auto append_string(std::vector<char>& bytes, std::string_view text) {
+	bytes.insert(bytes.end(), text.begin(), text.end());
+	bytes.push_back('\0');
+}
+inline auto append_attribute(std::vector<char>& bytes, std::string_view name, std::string_view type, const auto& append_value) {
+	append_string(bytes, name);
+	append_string(bytes, type);
+	std::vector<char> value;
+	append_value(value);
+	append_raw(bytes, int32_t(value.size()));
+	bytes.insert(bytes.end(), value.begin(), value.end());
+}
+
+inline auto get_lines_per_block(const raytracer::ExrCompression& compression) -> size_t {
+	return compression == raytracer::ExrCompression::zip ? 16 : 1;
+}
+
+/*
+	Both RLE and ZIP first split the bytes into even and odd halves, which puts the high bytes of
+	neighbouring values together, then store each byte as the difference from the one before.
+*/
+auto predict(std::span<const uint8_t> raw, std::vector<uint8_t>& out) {
+	out.resize(raw.size());
+	const auto half = (raw.size() + 1) / 2;
+	for (size_t i = 0; i < raw.size(); ++i) {
+		out[(i % 2 == 0) ? i / 2 : half + i / 2] = raw[i];
+	}
+	for (size_t i = out.size() - 1; i > 0; --i) {
+		out[i] = uint8_t(int(out[i]) - int(out[i - 1]) + 128);
+	}
+}
+
+// Runs of 3 to 128 equal bytes are a count and the byte, anything else a negative count and the bytes as they are.
+auto run_length_encode(std::span<const uint8_t> in) -> std::vector<uint8_t>
+{
+	std::vector<uint8_t> out;
+	out.reserve(in.size());
+	size_t run_start = 0;
+	size_t run_end = 1;
+	while (run_start < in.size()) {
+		while (run_end < in.size() && in[run_start] == in[run_end] && run_end - run_start - 1 < MAX_RUN_LENGTH) {
+			++run_end;
+		}
+		if (run_end - run_start >= MIN_RUN_LENGTH) {
+			out.push_back(uint8_t(run_end - run_start - 1));
+			out.push_back(in[run_start]);
+			run_start = run_end;
+		}
+		else {
+			while (run_end < in.size()
+				&& (run_end + 1 >= in.size() || in[run_end] != in[run_end + 1] || run_end + 2 >= in.size() || in[run_end + 1] != in[run_end + 2])
+				&& run_end - run_start < MAX_RUN_LENGTH) {
+				++run_end;
+			}
+			out.push_back(uint8_t(-int(run_end - run_start)));
+			out.insert(out.end(), in.begin() + run_start, in.begin() + run_end);
+			run_start = run_end;
+		}
+		++run_end;
+	}
+	return out;
+}
+
+// The block's scanlines, each holding every channel's row in name order.
+auto pack_block(
+	std::span<const raytracer::ImageChannel* const> channels,
+	const size_t& width,
+	const size_t& y_begin,
+	const size_t& y_end,
+	const bool& is_half,
+	std::vector<uint8_t>& raw) {
+	const auto value_size = is_half ? sizeof(Half) : sizeof(float);
+	raw.resize((y_end - y_begin) * channels.size() * width * value_size);
+	auto* out = raw.data();
+	for (size_t y = y_begin; y < y_end; ++y) {
+		for (const auto* channel : channels) {
+			const auto row = channel->values.subspan(y * width, width);
+			if (!is_half) {
+				std::memcpy(out, row.data(), width * sizeof(float));
+				out += width * sizeof(float);
+				continue;
+			}
+			for (const auto& value : row) {
+				const auto bits = Half::from_float(value).bits;
+				std::memcpy(out, &bits, sizeof(bits));
+				out += sizeof(bits);
+			}
+		}
+	}
+}
+
+// A block is stored as it is when compressing would not make it smaller, readers tell by its size.
+auto compress_block(std::span<const uint8_t> raw, const raytracer::ExrCompression& compression) -> std::vector<uint8_t>
+{
+	thread_local std::vector<uint8_t> predicted;
+	if (compression == raytracer::ExrCompression::none || raw.empty()) {
+		return std::vector<uint8_t>(raw.begin(), raw.end());
+	}
+	predict(raw, predicted);
+	auto packed = compression == raytracer::ExrCompression::rle ? run_length_encode(predicted) : raytracer::zlib_compress(predicted);
+	if (packed.size() >= raw.size()) {
+		return std::vector<uint8_t>(raw.begin(), raw.end());
+	}
+	return packed;
+}
+
+/*
+	Layout: magic, version, the header attributes ended by an empty name, a table with the file
+	offset of each block, then each block as its first y, its byte count and its data. Channels
+	are stored in name order, as the format requires.
+*/
+auto raytracer::write_exr(
+	const std::string& file_name,
+	const size_t& width,
+	const size_t& height,
+	std::span<const ImageChannel> channels,
+	const ExrSettings& settings) -> bool
+{
+	trace::ScopedEvent event{ "exr encoding" };
+	if (std::any_of(channels.begin(), channels.end(), [&](const auto& channel) { return channel.values.size() != width * height; })) [[unlikely]] {
+		return false;
+	}
+	std::vector<const ImageChannel*> sorted;
+	for (const auto& channel : channels) {
+		sorted.push_back(&channel);
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b) { return a->name < b->name; });
+
+	std::vector<char> header;
+	append_raw(header, EXR_MAGIC);
+	append_raw(header, EXR_VERSION);
+	append_attribute(header, "channels", "chlist", [&](auto& value) {
+		for (const auto* channel : sorted) {
+			append_string(value, channel->name);
+			append_raw(value, settings.is_half ? EXR_HALF : EXR_FLOAT);
+			append_raw(value, uint32_t(0));	// pLinear and three reserved bytes
+			append_raw(value, int32_t(1));	// x sampling
+			append_raw(value, int32_t(1));	// y sampling
+		}
+		value.push_back('\0');
+	});
+	append_attribute(header, "compression", "compression", [&](auto& value) { value.push_back(char(settings.compression)); });
+	const auto append_window = [&](auto& value) {
+		append_raw(value, int32_t(0));
+		append_raw(value, int32_t(0));
+		append_raw(value, int32_t(width) - 1);
+		append_raw(value, int32_t(height) - 1);
+	};
+	append_attribute(header, "dataWindow", "box2i", append_window);
+	append_attribute(header, "displayWindow", "box2i", append_window);
+	append_attribute(header, "lineOrder", "lineOrder", [](auto& value) { value.push_back(0); });
+	append_attribute(header, "pixelAspectRatio", "float", [](auto& value) { append_raw(value, 1.0f); });
+	append_attribute(header, "screenWindowCenter", "v2f", [](auto& value) { append_raw(value, 0.0f); append_raw(value, 0.0f); });
+	append_attribute(header, "screenWindowWidth", "float", [](auto& value) { append_raw(value, 1.0f); });
+	header.push_back('\0');
+
+	// Threads take blocks from a shared counter, the blocks are written in order once all are done.
+	const auto lines_per_block = get_lines_per_block(settings.compression);
+	const auto block_count = (height + lines_per_block - 1) / lines_per_block;
+	std::vector<std::vector<uint8_t>> blocks(block_count);
+	std::atomic<size_t> next_block = 0;
+	auto compress_blocks = [&]() {
+		std::vector<uint8_t> raw;
+		for (size_t i = next_block++; i < block_count; i = next_block++) {
+			const auto y_begin = i * lines_per_block;
+			pack_block(sorted, width, y_begin, std::min(y_begin + lines_per_block, height), settings.is_half, raw);
+			blocks[i] = compress_block(raw, settings.compression);
+		}
+	};
+	const auto thread_count = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, std::max<size_t>(block_count, 1));
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < thread_count; ++i) {
+		threads.emplace_back(compress_blocks);
+	}
+	compress_blocks();
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	auto offset = uint64_t(header.size() + block_count * sizeof(uint64_t));
+	for (const auto& block : blocks) {
+		append_raw(header, offset);
+		offset += 2 * sizeof(int32_t) + block.size();
+	}
+	std::ofstream file{ file_name, std::ios::binary | std::ios::trunc };
+	file.write(header.data(), header.size());
+	for (size_t i = 0; i < block_count; ++i) {
+		const auto y = int32_t(i * lines_per_block);
+		const auto size = int32_t(blocks[i].size());
+		file.write(reinterpret_cast<const char*>(&y), sizeof(y));
+		file.write(reinterpret_cast<const char*>(&size), sizeof(size));
+		file.write(reinterpret_cast<const char*>(blocks[i].data()), blocks[i].size());
+	}
+	return bool(file);
+}
+
+// Rows run from the bottom of the image up, and the negative scale marks the floats as little endian.
+auto raytracer::write_pfm(
+	const std::string& file_name,
+	const size_t& width,
+	const size_t& height,
+	std::span<const ImageChannel> channels) -> bool
+{
+	trace::ScopedEvent event{ "pfm encoding" };
+	if ((channels.size() != 1 && channels.size() != 3)
+		|| std::any_of(channels.begin(), channels.end(), [&](const auto& channel) { return channel.values.size() != width * height; })) [[unlikely]] {
+		return false;
+	}
+	std::ofstream file{ file_name, std::ios::binary | std::ios::trunc };
+	file << (channels.size() == 3 ? "PF" : "Pf") << "\n" << width << " " << height << "\n-1.0\n";
+	std::vector<float> row(width * channels.size());
+	for (size_t y = height; y-- > 0;) {
+		for (size_t x = 0; x < width; ++x) {
+			for (size_t c = 0; c < channels.size(); ++c) {
+				row[x * channels.size() + c] = channels[c].values[y * width + x];
+			}
+		}
+		file.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(float));
+	}
+	return bool(file);
+}
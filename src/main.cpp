@@ -1,19 +1,495 @@
 #include "linearAlgebra.h"
 #include "raytracer.h"
 #include "shapes.h"
+#include "stats.h"
+#include "trace.h"
+#include "output_pipeline.h"
+#include "texture.h"
+#include "scenes.h"
+#include "exr.h"
+#include "tonemap.h"
+#include "kernel.h"
+#ifdef RAYTRACER_DISTRIBUTED
+#include "distributed.h"
+#endif
 #include <string>
+#include <string_view>
+#include <optional>
 #include <algorithm>
+#include <functional>
 #include <numeric>
-#include <iterator>
+#include <span>
+#include <variant>
+#include <type_traits>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <ranges>
+#include <array>
+
+static raytracer::CancellationToken cancellation;
+
+auto get_option(int argc, char* argv[], std::string_view name) -> std::optional<std::string_view>
+{
+	for (int i = 1; i + 1 < argc; i++) {
+		if (argv[i] == name) {
+			return argv[i + 1];
+		}
+	}
+	return {};
+}
+auto get_options(int argc, char* argv[], std::string_view name) -> std::vector<std::string_view>
+{
+	std::vector<std::string_view> values;
+	for (int i = 1; i + 1 < argc; i++) {
+		if (argv[i] == name) {
+			values.emplace_back(argv[i + 1]);
+		}
+	}
+	return values;
+}
+auto has_flag(int argc, char* argv[], std::string_view name) -> bool
+{
+	return std::any_of(argv + 1, argv + argc, [&](const char* arg) { return arg == name; });
+}
+
+auto get_frame_name(const size_t& frame)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "frame_%04zu", frame);
+	return std::string(name);
+}
+
+// Float output of the image and its AOVs, without EXR settings each layer is written to its own PFM.
+struct LayerOutput {
+	std::optional<raytracer::ExrSettings> exr;
+};
+
+/*
+	The image as R, G and B with the written AOVs as layers beside it in name.exr, or as name.pfm with
+	a name.layer.pfm per AOV. The image is the direct plus indirect light, summed in float as it was
+	rendered. Denoising only filters the frame and distributed renders have no AOVs, so for those
+	the image is read from the frame.
+*/
+template<typename Pixel>
+auto save_layers(
+	const std::string& name,
+	const LayerOutput& output,
+	const raytracer::Camera& camera,
+	std::span<const Pixel> pixels,
+	const raytracer::RenderResult& result,
+	const raytracer::AovSet& written_aovs,
+	const bool& is_denoised)
+{
+	using raytracer::Aov;
+	std::array<std::vector<float>, 3> planes;
+	if (!is_denoised && result.aovs.enabled.contains(Aov::direct) && result.aovs.enabled.contains(Aov::indirect)) {
+		for (size_t c = 0; c < planes.size(); ++c) {
+			const auto direct = result.aovs.plane(Aov::direct, c);
+			const auto indirect = result.aovs.plane(Aov::indirect, c);
+			planes[c].resize(direct.size());
+			std::transform(direct.begin(), direct.end(), indirect.begin(), planes[c].begin(), std::plus<float>{});
+		}
+	}
+	else {
+		std::vector<RGBf> colour(pixels.size());
+		raytracer::convert_pixels(pixels, std::span<RGBf>(colour));
+		for (auto& plane : planes) {
+			plane.reserve(colour.size());
+		}
+		for (const auto& rgb : colour) {
+			planes[0].push_back(rgb.r);
+			planes[1].push_back(rgb.g);
+			planes[2].push_back(rgb.b);
+		}
+	}
+	const std::array<raytracer::ImageChannel, 3> image = {
+		raytracer::ImageChannel{ "R", planes[0] }, raytracer::ImageChannel{ "G", planes[1] }, raytracer::ImageChannel{ "B", planes[2] }
+	};
+	const auto width = size_t(camera.width);
+	const auto height = size_t(camera.height);
+	const auto write_pfm = [&](const std::string& file_name, std::span<const raytracer::ImageChannel> channels) {
+		if (!raytracer::write_pfm(file_name, width, height, channels)) {
+			std::cout << ".PFM ERROR:\tCould not write " << file_name << "\n";
+		}
+	};
+
+	if (!output.exr.has_value()) {
+		write_pfm(name + ".pfm", image);
+		for (size_t i = 0; i < raytracer::AOV_COUNT; ++i) {
+			const auto aov = raytracer::Aov(i);
+			if (!result.aovs.enabled.contains(aov) || !written_aovs.contains(aov)) {
+				continue;
+			}
+			std::vector<raytracer::ImageChannel> channels;
+			for (size_t c = 0; c < raytracer::get_channel_count(aov); ++c) {
+				channels.push_back(raytracer::ImageChannel{ "", result.aovs.plane(aov, c) });
+			}
+			write_pfm(name + "." + std::string(raytracer::AOV_NAMES[i]) + ".pfm", channels);
+		}
+		return;
+	}
+	auto channels = result.aovs.get_channels(written_aovs);
+	channels.insert(channels.end(), image.begin(), image.end());
+	if (!raytracer::write_exr(name + ".exr", width, height, channels, *output.exr)) {
+		std::cout << ".EXR ERROR:\tCould not write " << name << ".exr\n";
+	}
+}
+
+auto get_layer_output(int argc, char* argv[]) -> std::optional<LayerOutput>
+{
+	const auto format = get_option(argc, argv, "--layers");
+	if (!format.has_value() && !get_option(argc, argv, "--aovs")) {
+		return {};
+	}
+	if (format == "pfm") {
+		return LayerOutput{};
+	}
+	if (format.has_value() && *format != "exr") {
+		std::cout << "ERROR:\t--layers expects exr or pfm but got " << *format << ", writing exr\n";
+	}
+	raytracer::ExrSettings settings;
+	settings.is_half = has_flag(argc, argv, "--exr-half");
+	if (auto compression = get_option(argc, argv, "--exr-compression")) {
+		if (*compression == "none") {
+			settings.compression = raytracer::ExrCompression::none;
+		}
+		else if (*compression == "rle") {
+			settings.compression = raytracer::ExrCompression::rle;
+		}
+		else if (*compression == "zips") {
+			settings.compression = raytracer::ExrCompression::zips;
+		}
+		else if (*compression != "zip") {
+			std::cout << "ERROR:\t--exr-compression expects none, rle, zips or zip but got " << *compression << "\n";
+		}
+	}
+	return LayerOutput{ settings };
+}
+
+// Only set when one of the display options is given, so plain renders are written as they are.
+auto get_tonemap_settings(int argc, char* argv[]) -> std::optional<raytracer::TonemapSettings>
+{
+	const auto exposure = get_option(argc, argv, "--exposure");
+	const auto curve = get_option(argc, argv, "--tonemap");
+	const auto is_srgb = has_flag(argc, argv, "--srgb");
+	const auto is_dithered = has_flag(argc, argv, "--dither");
+	if (!exposure.has_value() && !curve.has_value() && !is_srgb && !is_dithered) {
+		return {};
+	}
+	raytracer::TonemapSettings settings{ .is_srgb = is_srgb, .is_dithered = is_dithered };
+	if (exposure.has_value()) {
+		settings.exposure = std::stof(std::string(*exposure));
+	}
+	if (curve.has_value()) {
+		if (auto parsed = raytracer::parse_tone_curve(*curve)) {
+			settings.curve = *parsed;
+		}
+		else {
+			std::cout << "ERROR:\t--tonemap expects none, reinhard or aces but got " << *curve << "\n";
+		}
+	}
+	return settings;
+}
+
+// Writes the image as it is, or tonemapped to 8 bits first, reusing one buffer between frames.
+template<typename Pixel>
+auto get_ppm_encoder(const std::optional<raytracer::TonemapSettings>& settings) -> typename raytracer::OutputPipeline<Pixel>::Encoder
+{
+	if (!settings.has_value()) {
+		return raytracer::write_ppm<Pixel>;
+	}
+	return [settings = *settings, tonemapped = std::vector<RGB8>()](const std::string& file_name, const raytracer::ImageView<Pixel>& image) mutable {
+		tonemapped.resize(image.width * image.height);
+		raytracer::tonemap(image, std::span<RGB8>(tonemapped), settings);
+		return raytracer::write_ppm(file_name, raytracer::ImageView<RGB8>{ tonemapped, image.width, image.height });
+	};
+}
+
+template<typename Pixel>
+auto save_ppm(const std::string& file_name, const raytracer::ImageView<Pixel>& image, const std::optional<raytracer::TonemapSettings>& tonemap = {})
+{
+	if (!get_ppm_encoder<Pixel>(tonemap)(file_name, image)) {
+		std::cout << ".PPM ERROR:\tCould not write " << file_name << "\n";
+	}
+}
+
+auto get_progressive_settings(int argc, char* argv[], const raytracer::Camera& camera)
+{
+	raytracer::ProgressiveSettings settings;
+	if (auto passes = get_option(argc, argv, "--passes")) {
+		settings.max_passes = std::stoul(std::string(*passes));
+	}
+	if (auto passes = get_option(argc, argv, "--preview-passes")) {
+		settings.preview_pass_interval = std::stoul(std::string(*passes));
+	}
+	if (auto seconds = get_option(argc, argv, "--preview-seconds")) {
+		settings.preview_time_interval = std::chrono::milliseconds(long(std::stof(std::string(*seconds)) * 1000));
+	}
+	if (auto seconds = get_option(argc, argv, "--time-budget")) {
+		settings.time_budget = std::chrono::milliseconds(long(std::stof(std::string(*seconds)) * 1000));
+	}
+	if (auto threshold = get_option(argc, argv, "--noise-threshold")) {
+		settings.noise_threshold = std::stof(std::string(*threshold));
+	}
+	if (auto seed = get_option(argc, argv, "--seed")) {
+		settings.seed = std::stoull(std::string(*seed));
+	}
+	if (auto path = get_option(argc, argv, "--checkpoint")) {
+		settings.checkpoint_path = *path;
+	}
+	if (auto passes = get_option(argc, argv, "--checkpoint-passes")) {
+		settings.checkpoint_pass_interval = std::stoul(std::string(*passes));
+	}
+	if (auto seconds = get_option(argc, argv, "--checkpoint-seconds")) {
+		settings.checkpoint_time_interval = std::chrono::milliseconds(long(std::stof(std::string(*seconds)) * 1000));
+	}
+	settings.resume = has_flag(argc, argv, "--resume");
+	settings.on_preview = [&camera, tonemap = get_tonemap_settings(argc, argv)](raytracer::PixelSpan preview, const size_t& pass) {
+		std::cout << "Preview Pass = " << pass << "\n";
+		std::visit([&](const auto& pixels) {
+			save_ppm("preview.ppm", raytracer::ImageView{ pixels, size_t(camera.width), size_t(camera.height) }, tonemap);
+		}, preview);
+	};
+	return settings;
+}
+
+// Reads a count that has to be one the render kernels were compiled for.
+template<size_t SIZE>
+auto get_kernel_option(int argc, char* argv[], std::string_view name, const std::array<size_t, SIZE>& allowed, size_t& value)
+{
+	const auto option = get_option(argc, argv, name);
+	if (!option.has_value()) {
+		return;
+	}
+	const auto parsed = std::strtoul(std::string(*option).c_str(), nullptr, 10);
+	if (std::find(allowed.begin(), allowed.end(), parsed) != allowed.end()) {
+		value = parsed;
+		return;
+	}
+	std::cout << "ERROR:\t" << name << " expects";
+	for (size_t i = 0; i < SIZE; ++i) {
+		std::cout << (i == 0 ? " " : i + 1 == SIZE ? " or " : ", ") << allowed[i];
+	}
+	std::cout << " but got " << *option << "\n";
+}
+
+auto get_render_control(int argc, char* argv[])
+{
+	raytracer::RenderControl control{ &cancellation };
+	if (auto seconds = get_option(argc, argv, "--deadline")) {
+		control.deadline = std::chrono::steady_clock::now() 
+			+ std::chrono::milliseconds(long(std::stof(std::string(*seconds)) * 1000));
+	}
+	for (const auto& region : get_options(argc, argv, "--region")) {
+		raytracer::Tile tile;
+		if (std::sscanf(std::string(region).c_str(), "%zu,%zu,%zu,%zu", &tile.x_begin, &tile.y_begin, &tile.x_end, &tile.y_end) != 4) {
+			std::cout << "ERROR:\t--region expects x_begin,y_begin,x_end,y_end but got " << region << "\n";
+			continue;
+		}
+		control.regions.push_back(tile);
+	}
+	if (auto metric = get_option(argc, argv, "--heatmap")) {
+		if (*metric == "time") {
+			control.pixel_cost = raytracer::PixelCost::time;
+		}
+		else if (*metric == "intersections") {
+			control.pixel_cost = raytracer::PixelCost::intersections;
+		}
+		else {
+			std::cout << "ERROR:\t--heatmap expects time or intersections but got " << *metric << "\n";
+		}
+	}
+	control.sort_by_material = has_flag(argc, argv, "--sort-materials");
+	get_kernel_option(argc, argv, "--ray-depth", raytracer::KERNEL_RAY_DEPTHS, control.ray_depth);
+	get_kernel_option(argc, argv, "--samples", raytracer::KERNEL_SAMPLE_COUNTS, control.samples_per_pixel);
+	if (auto names = get_option(argc, argv, "--aovs")) {
+		for (const auto name : std::views::split(*names, ',')) {
+			const auto name_view = std::string_view(name.begin(), name.end());
+			if (name_view == "all") {
+				for (size_t i = 0; i < raytracer::AOV_COUNT; ++i) {
+					control.aovs = control.aovs.with(raytracer::Aov(i));
+				}
+			}
+			else if (auto aov = raytracer::parse_aov(name_view)) {
+				control.aovs = control.aovs.with(*aov);
+			}
+			else {
+				std::cout << "ERROR:\t--aovs expects depth, normal, albedo, object_id, direct, indirect or all but got " << name_view << "\n";
+			}
+		}
+	}
+	if (has_flag(argc, argv, "--denoise")) {
+		control.denoise = raytracer::DenoiseSettings{};
+		if (auto iterations = get_option(argc, argv, "--denoise-iterations")) {
+			control.denoise->iterations = std::stoul(std::string(*iterations));
+		}
+	}
+	std::signal(SIGINT, [](int) { cancellation.cancel(); });
+	std::signal(SIGTERM, [](int) { cancellation.cancel(); });
+	return control;
+}
+
+#ifdef RAYTRACER_DISTRIBUTED
+auto get_coordinator_settings(int argc, char* argv[], std::string_view socket_path, const raytracer::scenes::SceneDescription& scene_description)
+{
+	raytracer::distributed::CoordinatorSettings settings{ std::string(socket_path) };
+	settings.scene = scene_description;
+	settings.worker_executable = argv[0];
+	if (auto count = get_option(argc, argv, "--spawn-workers")) {
+		settings.spawn_local_workers = std::stoul(std::string(*count));
+	}
+	if (auto seconds = get_option(argc, argv, "--tile-timeout")) {
+		settings.tile_timeout = std::chrono::milliseconds(long(std::stof(std::string(*seconds)) * 1000));
+	}
+	return settings;
+}
+#endif
+
+auto get_scene_description(int argc, char* argv[]) -> raytracer::scenes::SceneDescription
+{
+	raytracer::scenes::SceneDescription description;
+	description.reference_scene = std::string(get_option(argc, argv, "--scene").value_or("default"));
+	if (auto path = get_option(argc, argv, "--texture")) {
+		description.texture_path = std::string(*path);
+		description.texture_cache_mb = std::stoul(std::string(get_option(argc, argv, "--texture-cache-mb").value_or("64")));
+		description.texture_cache_directory = std::string(get_option(argc, argv, "--texture-cache-dir").value_or(""));
+	}
+	return description;
+}
+
+// Every path renders straight into the output image's buffer.
+template<typename Pixel>
+auto render(int argc, char* argv[], const raytracer::Camera& camera, const raytracer::Scene& scene, const raytracer::scenes::SceneDescription& scene_description,
+	const raytracer::RenderControl& control, std::span<Pixel> pixels)
+{
+#ifdef RAYTRACER_DISTRIBUTED
+	if (auto socket_path = get_option(argc, argv, "--coordinator")) {
+		return raytracer::distributed::run_coordinator(camera, scene, get_coordinator_settings(argc, argv, *socket_path, scene_description), pixels, control);
+	}
+#endif
+	if (has_flag(argc, argv, "--progressive")) {
+		const auto result = raytracer::render(camera, scene, get_progressive_settings(argc, argv, camera), pixels, control);
+		std::cout << "Progressive Passes = " << result.passes << "\n";
+		return result;
+	}
+	return raytracer::render(camera, scene, pixels, control);
+}
 
 int main(int argc, char* argv[])
 {
+#ifdef RAYTRACER_DISTRIBUTED
+	if (auto socket_path = get_option(argc, argv, "--worker")) {
+		return raytracer::distributed::run_worker(std::string(*socket_path)) ? 0 : -1;
+	}
+#endif
+	const auto trace_path = get_option(argc, argv, "--trace");
+	if (trace_path.has_value()) {
+		trace::start();
+	}
 	static const auto camera = raytracer::Camera{1080, 1080, degrees_to_radians(90) };
-	static const auto colour = raytracer::render(camera);
+	const auto layer_output = get_layer_output(argc, argv);
+	auto control = get_render_control(argc, argv);
+	// The float image is made from the direct and indirect light, so they are rendered whether or not they are written.
+	const auto written_aovs = control.aovs;
+	if (layer_output.has_value()) {
+		control.aovs = control.aovs.with(raytracer::Aov::direct).with(raytracer::Aov::indirect);
+	}
+	// Distributed workers build the scene from its description, so a scene that can't be built falls back to the default for both.
+	auto scene_description = get_scene_description(argc, argv);
+	auto scene = raytracer::scenes::make_scene(scene_description);
+	if (!scene.has_value()) {
+		if (!scene_description.texture_path.empty()) {
+			std::cout << "ERROR:\tCould not load --texture " << scene_description.texture_path << ", rendering the default scene\n";
+		}
+		else {
+			std::cout << "ERROR:\t--scene expects default, dense_spheres, many_lights, deep_bounces, mirrors_and_glass or procedural but got "
+				<< scene_description.reference_scene << "\n";
+		}
+		scene_description = {};
+		scene = raytracer::make_default_scene();
+	}
+	const auto tonemap = get_tonemap_settings(argc, argv);
+
+	auto format = raytracer::PixelFormat::rgb8;
+	if (auto name = get_option(argc, argv, "--pixel-format")) {
+		if (auto parsed = raytracer::parse_pixel_format(*name)) {
+			format = *parsed;
+		}
+		else {
+			std::cout << "ERROR:\t--pixel-format expects rgb, rgb8, rgba8, rgb16, half or float but got " << *name << "\n";
+		}
+	}
+
+	const auto frame_count = std::stoul(std::string(get_option(argc, argv, "--frames").value_or("1")));
+	const auto buffer_count = std::stoul(std::string(get_option(argc, argv, "--output-buffers").value_or("2")));
+	std::optional<raytracer::Tile> crop_bounds;
+	const auto has_valid_regions = std::all_of(control.regions.begin(), control.regions.end(),
+		[](const auto& region) { return raytracer::is_valid_region(camera, region); });
+	if (has_flag(argc, argv, "--crop") && !control.regions.empty() && has_valid_regions) {
+		auto bounds = control.regions.front();
+		for (const auto& region : control.regions) {
+			bounds = raytracer::Tile{
+				std::min(bounds.x_begin, region.x_begin), std::min(bounds.y_begin, region.y_begin),
+				std::max(bounds.x_end, region.x_end), std::max(bounds.y_end, region.y_end)
+			};
+		}
+		crop_bounds = bounds;
+	}
+
+	// Frame N is encoded and written on the pipeline's thread while frame N + 1 renders.
+	const auto result = raytracer::visit_pixel_format(format, [&](const auto& pixel) {
+		using Pixel = std::decay_t<decltype(pixel)>;
+		raytracer::OutputPipeline<Pixel> pipeline(camera.width, camera.height, std::min(buffer_count, frame_count), get_ppm_encoder<Pixel>(tonemap));
+		raytracer::RenderResult result{};
+		for (size_t i = 0; i < frame_count; ++i) {
+			const auto frame = pipeline.acquire();
+			result = render(argc, argv, camera, *scene, scene_description, control, frame.pixels);
+			std::cout << "Render Time = " << result.render_time << "\n";
+
+			if (!result.is_complete) {
+				const auto tiles_done = std::count_if(result.tile_coverage.begin(), result.tile_coverage.end(), 
+					[](const auto& passes) { return passes > 0; });
+				std::cout << "Render Stopped Early: " << tiles_done << " / " << result.tiles.size() << " tiles rendered at least once\n";
+			}
+			if (layer_output.has_value()) {
+				const auto is_denoised = control.denoise.has_value() && result.is_complete;
+				save_layers(frame_count > 1 ? get_frame_name(i) : "test", *layer_output, camera, std::span<const Pixel>(frame.pixels), result, written_aovs, is_denoised);
+			}
+			pipeline.submit(frame, (frame_count > 1 ? get_frame_name(i) : "test") + ".ppm", crop_bounds);
+			if (control.should_stop()) {
+				break;
+			}
+		}
+		return result;
+	});
+
+	if (!result.pixel_cost.empty()) {
+		const auto heatmap = raytracer::make_heatmap(result.pixel_cost);
+		save_ppm("heatmap.ppm", raytracer::ImageView{ heatmap, size_t(camera.width), size_t(camera.height) });
+	}
+	if (scene->textures) {
+		const auto stats = scene->textures->get_stats();
+		std::cout << "Texture Cache = " << stats.lookups << " lookups, " << stats.tile_loads << " tile loads, "
+			<< stats.evictions << " evictions, " << (scene->textures->get_resident_bytes() >> 10) << " KiB resident\n";
+	}
+	if (trace_path.has_value() && !trace::write_chrome_json(std::string(*trace_path))) {
+		std::cout << "TRACE ERROR:\tCould not write " << *trace_path << "\n";
+	}
 
-	PPM output("test.ppm", camera.width, camera.height);
-	std::copy(colour.begin(), colour.end(), std::back_inserter(output.colour_info));
-	output.create_ppm();
+#ifdef RAYTRACER_STATS
+	if (has_flag(argc, argv, "--stats")) {
+		stats::print_summary(std::cout);
+	}
+	if (auto path = get_option(argc, argv, "--stats-json")) {
+		std::ofstream stats_file{ std::string(*path) };
+		stats::print_json(stats_file);
+	}
+#else
+	if (has_flag(argc, argv, "--stats") || get_option(argc, argv, "--stats-json")) {
+		std::cout << "Stats are not available, rebuild with -DRAYTRACER_STATS=ON\n";
+	}
+#endif
 
 	return 1;
-}
\ No newline at end of file
+}
@@ -0,0 +1,127 @@
+#include <cstdint>
+#include <cmath>
+#include <span>
+#include <vector>
+#include <algorithm>
+
+#include "procedural.h"
+
+constexpr int NOISE_OCTAVES = 4;
+
+// Truncation and a compare instead of std::floor, which keeps the loops free of library calls.
+inline auto fast_floor(const float& value) -> int32_t {
+	const auto truncated = int32_t(value);
+	return truncated - int32_t(value < float(truncated));
+}
+
+inline auto hash_lattice(const int32_t& x, const int32_t& y, const int32_t& z) -> uint32_t {
+	auto hash = (uint32_t(x) * 0x8da6b343u) ^ (uint32_t(y) * 0xd8163841u) ^ (uint32_t(z) * 0xcb1ab31fu);
+	hash ^= hash >> 15;
+	hash *= 0x2c1b3c6du;
+	hash ^= hash >> 12;
+	return hash;
+}
+
+// Ken Perlin's twelve edge gradients, picked with selects rather than branches.
+inline auto gradient_dot(const uint32_t& hash, const float& x, const float& y, const float& z) -> float {
+	const auto h = hash & 15;
+	const auto u = h < 8 ? x : y;
+	const auto v = h < 4 ? y : (h == 12 || h == 14 ? x : z);
+	return ((h & 1) ? -u : u) + ((h & 2) ? -v : v);
+}
+
+inline auto fade(const float& t) {
+	return t * t * t * (t * (t * 6 - 15) + 10);
+}
+
+inline auto lerp(const float& a, const float& b, const float& t) {
+	return a + t * (b - a);
+}
+
+// Gradient noise in roughly -1 to 1, with gradients hashed from the lattice so no table is needed.
+inline auto gradient_noise(const float& x, const float& y, const float& z) -> float {
+	const auto xi = fast_floor(x), yi = fast_floor(y), zi = fast_floor(z);
+	const auto fx = x - xi, fy = y - yi, fz = z - zi;
+	const auto u = fade(fx), v = fade(fy), w = fade(fz);
+
+	const auto corner = [&](const int32_t& dx, const int32_t& dy, const int32_t& dz) {
+		return gradient_dot(hash_lattice(xi + dx, yi + dy, zi + dz), fx - dx, fy - dy, fz - dz);
+	};
+	return lerp(
+		lerp(lerp(corner(0, 0, 0), corner(1, 0, 0), u), lerp(corner(0, 1, 0), corner(1, 1, 0), u), v),
+		lerp(lerp(corner(0, 0, 1), corner(1, 0, 1), u), lerp(corner(0, 1, 1), corner(1, 1, 1), u), v),
+		w);
+}
+
+/*
+	Adds octaves at double the frequency and half the amplitude to sums, one octave over the whole
+	batch at a time so each pass is a single loop. Absolute values give the turbulence used by marble.
+*/
+template<bool IS_TURBULENCE>
+inline auto add_fractal_noise(
+	std::span<const float> x,
+	std::span<const float> y,
+	std::span<const float> z,
+	const float& scale,
+	std::span<float> sums) {
+	auto amplitude = 0.5f;
+	auto frequency = scale;
+	for (int octave = 0; octave < NOISE_OCTAVES; ++octave) {
+		for (size_t i = 0; i < sums.size(); ++i) {
+			const auto noise = gradient_noise(x[i] * frequency, y[i] * frequency, z[i] * frequency);
+			sums[i] += amplitude * (IS_TURBULENCE ? std::abs(noise) : noise);
+		}
+		amplitude *= 0.5f;
+		frequency *= 2;
+	}
+}
+
+auto raytracer::evaluate_procedural(
+	const ProceduralTexture& texture,
+	std::span<const float> x,
+	std::span<const float> y,
+	std::span<const float> z,
+	std::span<RGB> colours) -> void
+{
+	const auto count = std::min({ x.size(), y.size(), z.size(), colours.size() });
+	const auto scale = texture.scale;
+	thread_local std::vector<float> blend;
+	blend.resize(count);
+
+	switch (texture.pattern) {
+	case Pattern::checker:
+		for (size_t i = 0; i < count; ++i) {
+			blend[i] = float((fast_floor(x[i] * scale) + fast_floor(y[i] * scale) + fast_floor(z[i] * scale)) & 1);
+		}
+		break;
+	case Pattern::gradient:
+		for (size_t i = 0; i < count; ++i) {
+			blend[i] = std::clamp(0.5f + 0.5f * y[i] * scale, 0.0f, 1.0f);
+		}
+		break;
+	case Pattern::noise:
+		std::fill(blend.begin(), blend.end(), 0.5f);
+		add_fractal_noise<false>(x, y, z, scale, blend);
+		for (size_t i = 0; i < count; ++i) {
+			blend[i] = std::clamp(blend[i], 0.0f, 1.0f);
+		}
+		break;
+	case Pattern::marble:
+		std::fill(blend.begin(), blend.end(), 0.0f);
+		add_fractal_noise<true>(x, y, z, scale, blend);
+		for (size_t i = 0; i < count; ++i) {
+			blend[i] = 0.5f + 0.5f * std::sin(x[i] * scale + 8 * blend[i]);
+		}
+		break;
+	}
+
+	const auto& a = texture.colour_a;
+	const auto& b = texture.colour_b;
+	for (size_t i = 0; i < count; ++i) {
+		colours[i] = RGB{
+			int(a.r + blend[i] * (b.r - a.r) + 0.5f),
+			int(a.g + blend[i] * (b.g - a.g) + 0.5f),
+			int(a.b + blend[i] * (b.b - a.b) + 0.5f)
+		};
+	}
+}
@@ -10,7 +10,6 @@
 #include <ranges>
 #include <numeric>
 #include <thread>
-#include <execution>
 #include <cstdlib>
 #include <thread>
 #include <random>
@@ -18,11 +17,44 @@
 #include <random>
 #include <string>
 #include <array>
+#include <limits>
+#include <atomic>
+#include <mutex>
+#include <span>
+#include <algorithm>
+#include <charconv>
 
 #include "raytracer.h"
 #include "shapes.h"
+#include "checkpoint.h"
+#include "stats.h"
+#include "trace.h"
+#include "texture.h"
+#include "kernel.h"
 
-constexpr size_t RAY_DEPTH = 10;
+constexpr size_t THREAD_COUNT = 10;
+
+/*
+	A shaded sample, with the share of its light that came straight from the lights at the first
+	diffuse surface it reached, for the direct and indirect AOVs. Samples that never reach one are black.
+*/
+struct Shade {
+	RGB colour;
+	float direct_share = 0;
+};
+
+/*
+	Rays are tallied by every build, one add to a thread_local per ray or per hit is cheap next to tracing.
+	Intersection tests cost an add per sphere, so they are left to the stats counters.
+*/
+static thread_local raytracer::RayCounts thread_ray_counts;
+
+// The calling thread's tallies, intersection tests are zero unless RAYTRACER_STATS is defined.
+inline auto get_thread_ray_counts() -> raytracer::RayCounts {
+	auto counts = thread_ray_counts;
+	counts.intersection_tests = RT_STAT_GET(intersection_tests);
+	return counts;
+}
 
 struct HitRecord {
 	bool has_hit;
@@ -43,9 +75,10 @@ inline auto find_first_hit(
 	const vec3& direction,
 	const pt3& origin) -> HitRecord
 {
-	std::optional<float> t_min;
+	std::optional<Real> t_min;
 	auto index = 0;
 	auto shape_index = 0;
+	RT_STAT_ADD(intersection_tests, objects.spheres.size());
 
 	for (const auto& sphere : objects.spheres) {
 		const auto t = shapes::get_hit_t(sphere, origin, direction);
@@ -63,7 +96,7 @@ inline auto find_first_hit(
 		return HitRecord{};
 	}
 	//sphere
-	else if (shape_index < objects.spheres.size()) {
+	else if (size_t(shape_index) < objects.spheres.size()) {
 		const auto hit_pt = pt_from_ray(origin, direction, t_min.value());
 		return HitRecord{
 			shape_index,
@@ -84,21 +117,23 @@ inline auto get_lit_count(
 	const raytracer::Scene& objects,
 	const pt3& hit) -> float
 {
-	static const float increment = 1 / objects.point_lights.size();
+	const float increment = 1.0f / objects.point_lights.size();
 	float lit_increment = increment;
 	float lit_count = 0;
 	auto direction = vec3{ 0,0,0 };
 
+	thread_ray_counts.shadow += objects.point_lights.size();
+	RT_STAT_ADD(shadow_rays, objects.point_lights.size());
+	RT_STAT_ADD(intersection_tests, objects.point_lights.size() * objects.spheres.size());
 	for (const auto& light : objects.point_lights)
 	{
 		direction = vec_from_pts(light, hit);
-		for (auto& s : objects.spheres)
+		for (const auto& s : objects.spheres)
 		{
 			auto tt = shapes::get_hit_tt(s, hit, direction);
 			if (tt.has_value()) {
-				constexpr float min = 0.0001;
-				auto t1 = round(0, tt.value().first, min);
-				auto t2 = round(0, tt.value().second, min);
+				auto t1 = round<Real>(0, tt.value().first, SHADOW_EPSILON);
+				auto t2 = round<Real>(0, tt.value().second, SHADOW_EPSILON);
 				if (t1 < 0 && t2 > 0 ) {
 					lit_increment = 0;
 				}
@@ -119,10 +154,27 @@ inline auto get_lit_count(
 	return lit_count;
 }
 
+inline auto random_engine() -> std::default_random_engine& {
+	thread_local std::default_random_engine rand_engine;
+	return rand_engine;
+}
+
+/*
+	Every sample reseeds from its pixel and sample index, so a pixel's noise does not depend on
+	which thread rendered it or in what order. That makes renders repeatable and resumable.
+*/
+inline auto seed_sampler(const uint64_t& seed, const size_t& pixel_index, const uint32_t& sample_index) {
+	uint64_t hash = seed ^ (uint64_t(pixel_index) << 20) ^ sample_index;
+	hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+	hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+	hash = hash ^ (hash >> 31);
+	random_engine().seed(std::default_random_engine::result_type(hash));
+}
+
 inline auto random_vec() {
 	vec3 random;
-	static std::default_random_engine rand_engine;
-	static std::uniform_real_distribution<float> get_rand(-1, 1);
+	auto& rand_engine = random_engine();
+	std::uniform_real_distribution<float> get_rand(-1, 1);
 	random = {
 		get_rand(rand_engine),
 		get_rand(rand_engine),
@@ -131,19 +183,22 @@ inline auto random_vec() {
 	return random;
 }
 
+template<typename Features>
 inline auto recursive_get_colour(
 	const raytracer::Scene& objects,
 	const vec3& direction,
 	const pt3& origin,
 	std::vector<float>& light_depth,
-	const RGB& colour) -> RGB {
+	const RGB& colour) -> Shade {
 
+	thread_ray_counts.bounce++;
+	RT_STAT_ADD(bounce_rays, 1);
 	const auto hit = find_first_hit(objects, direction, origin);
-	if (hit.has_hit && light_depth.size() < RAY_DEPTH)
+	if (hit.has_hit && light_depth.size() < Features::ray_depth)
 	{
 		vec3 rand_direction = uvec_to_vec(normalise(random_vec() + hit.normal));
 		light_depth.emplace_back(get_lit_count(objects, hit.point));
-		return recursive_get_colour(objects, rand_direction, hit.point, light_depth, colour);
+		return recursive_get_colour<Features>(objects, rand_direction, hit.point, light_depth, colour);
 	}
 	else {
 		float factor = 0;
@@ -151,41 +206,313 @@ inline auto recursive_get_colour(
 		{
 			factor += light_depth[i] * pow(0.5, i + 1);
 		}
-		return colour.multiply(factor);
+		return Shade{ colour.multiply(factor), factor > 0 ? light_depth[0] * 0.5f / factor : 0 };
 	}
 }
 
-inline auto get_colour(
+template<typename Features>
+inline auto shade_hit(
+	const raytracer::Scene& objects,
+	const vec3& direction,
+	const HitRecord& hit,
+	const RGB& colour,
+	const size_t& specular_depth,
+	const float& pixel_spread) -> Shade;
+
+// Mirror and glass rays carry on until they reach a diffuse surface or the background.
+template<typename Features>
+inline auto get_specular_colour(
 	const raytracer::Scene& objects,
-	const vec3& direction, 
+	const vec3& direction,
 	const pt3& origin,
-	const RGB& colour) -> RGB {
+	const RGB& colour,
+	const size_t& specular_depth,
+	const float& pixel_spread) -> Shade {
+	thread_ray_counts.bounce++;
+	RT_STAT_ADD(bounce_rays, 1);
 	const auto hit = find_first_hit(objects, direction, origin);
+	return shade_hit<Features>(objects, direction, hit, colour, specular_depth + 1, pixel_spread);
+}
 
-	if (hit.has_hit)
-	{
-		std::vector<float> light_depth{};
-		light_depth.reserve(RAY_DEPTH);
-		light_depth.emplace_back(get_lit_count(objects, hit.point));
-		const auto colour2 = std::get<RGB>(objects.materials[hit.shape_index]);
+inline auto scale(const vec3& v, const float& factor) {
+	return vec3{ v.i * factor, v.j * factor, v.k * factor };
+}
+inline auto reflect(const vec3& direction, const vec3& unit_normal) {
+	return direction - scale(unit_normal, 2 * dot_product(direction, unit_normal));
+}
+// The normal faces the incoming ray and eta is the ratio of refractive indices, empty on total internal reflection.
+inline auto refract(const vec3& unit_direction, const vec3& unit_normal, const float& eta) -> std::optional<vec3> {
+	const auto cos_incident = -dot_product(unit_direction, unit_normal);
+	const auto k = 1 - eta * eta * (1 - cos_incident * cos_incident);
+	if (k < 0) {
+		return {};
+	}
+	return scale(unit_direction, eta) + scale(unit_normal, eta * cos_incident - sqrt(k));
+}
+
+template<typename Features>
+inline auto shade_glass(
+	const raytracer::Scene& objects,
+	const vec3& direction,
+	const HitRecord& hit,
+	const RGB& colour,
+	const size_t& specular_depth,
+	const float& pixel_spread) -> Shade {
+	constexpr size_t MAX_INTERNAL_REFLECTIONS = 4;
+	const auto& sphere = objects.spheres[hit.shape_index];
+	const auto refractive_index = objects.materials.refractive_indices[hit.shape_index];
+	const auto blur_amount = objects.materials.amounts[hit.shape_index];
+	const auto blur = [&](const vec3& v) { return blur_amount > 0 ? v + scale(random_vec(), blur_amount) : v; };
+
+	const auto unit_direction = uvec_to_vec(normalise(direction));
+	const auto unit_normal = uvec_to_vec(normalise(hit.normal));
+	const auto refracted = refract(unit_direction, unit_normal, 1 / refractive_index);
 
-		const vec3 rand_direction = random_vec() + hit.normal;
-		return recursive_get_colour(objects, rand_direction, hit.point, light_depth, colour2);
+	// Schlick's approximation of the Fresnel reflectance chooses between reflecting and refracting per sample.
+	const auto cos_incident = -dot_product(unit_direction, unit_normal);
+	const auto r0 = pow((1 - refractive_index) / (1 + refractive_index), 2);
+	const auto reflectance = r0 + (1 - r0) * pow(1 - cos_incident, 5);
+	std::uniform_real_distribution<float> get_chance(0, 1);
+	if (!refracted.has_value() || get_chance(random_engine()) < reflectance) {
+		const auto reflected = blur(reflect(unit_direction, unit_normal));
+		return get_specular_colour<Features>(objects, reflected, hit.point, colour, specular_depth, pixel_spread);
 	}
-	else {
-		return colour;
+
+	// Inside a sphere the only thing to hit is its far wall, so the exit is found without a scene query.
+	auto inside_direction = *refracted;
+	auto origin = hit.point;
+	for (size_t i = 0; i < MAX_INTERNAL_REFLECTIONS; ++i) {
+		const auto exit_point = pt_from_ray(origin, inside_direction, shapes::get_exit_t(sphere, origin, inside_direction));
+		const auto exit_normal = uvec_to_vec(normalise(shapes::get_normal_vec(sphere, exit_point)));
+		const auto leaving = refract(inside_direction, scale(exit_normal, -1), refractive_index);
+		if (leaving.has_value()) {
+			const auto outside_direction = blur(*leaving);
+			return get_specular_colour<Features>(objects, outside_direction, exit_point, colour, specular_depth, pixel_spread);
+		}
+		inside_direction = reflect(inside_direction, exit_normal);
+		origin = exit_point;
+	}
+	return Shade{ colour };
+}
+
+template<typename Features>
+inline auto shade_diffuse(
+	const raytracer::Scene& objects,
+	const HitRecord& hit,
+	const RGB& surface_colour) -> Shade {
+	RT_STAT_ADD(allocations, 1);
+	std::vector<float> light_depth{};
+	light_depth.reserve(Features::ray_depth);
+	light_depth.emplace_back(get_lit_count(objects, hit.point));
+
+	const vec3 rand_direction = random_vec() + hit.normal;
+	return recursive_get_colour<Features>(objects, rand_direction, hit.point, light_depth, surface_colour);
+}
+
+/*
+	Picks the MIP level whose texels are about the size of the pixel's footprint at the hit. The footprint
+	grows with the distance from the camera, reflections and refractions are treated as if they were seen
+	directly, and one texel covers 2 pi r / width of the sphere's surface.
+*/
+inline auto get_texture_colour(
+	const raytracer::Scene& objects,
+	const HitRecord& hit,
+	const float& pixel_spread) -> RGB {
+	const auto& sphere = objects.spheres[hit.shape_index];
+	const auto texture = objects.materials.textures[hit.shape_index];
+	const auto [u, v] = shapes::get_sphere_uv(sphere, hit.point);
+	const auto footprint = float(magnitude(vec_from_pts(hit.point, pt3{ 0,0,0 }))) * pixel_spread;
+	const auto texel_size = float(2 * M_PI) * float(sphere.radius) / objects.textures->get_width(texture);
+	const auto texel = objects.textures->sample(texture, u, v, std::log2(std::max(footprint / texel_size, 1.0f)));
+	return RGB{ int(texel.r + 0.5f), int(texel.g + 0.5f), int(texel.b + 0.5f) };
+}
+
+inline auto get_procedural_colour(
+	const raytracer::Scene& objects,
+	const HitRecord& hit) -> RGB {
+	// The pattern is evaluated in float in every precision mode.
+	const auto offset = cast<float>(shapes::get_normal_vec(objects.spheres[hit.shape_index], hit.point));
+	RGB albedo;
+	raytracer::evaluate_procedural(objects.materials.procedurals[hit.shape_index],
+		std::span(&offset.i, 1), std::span(&offset.j, 1), std::span(&offset.k, 1), std::span(&albedo, 1));
+	return albedo;
+}
+
+/*
+	Kinds outside the kernel's material set are never dispatched to it, so their cases are compiled
+	out, and a kernel for diffuse shapes alone has no switch at all.
+*/
+template<typename Features>
+inline auto shade_hit(
+	const raytracer::Scene& objects,
+	const vec3& direction,
+	const HitRecord& hit,
+	const RGB& colour,
+	const size_t& specular_depth,
+	const float& pixel_spread) -> Shade {
+	using raytracer::MaterialKind;
+	if (!hit.has_hit) {
+		return Shade{ colour };
+	}
+	if constexpr (Features::materials == raytracer::get_material_bit(MaterialKind::diffuse)) {
+		return shade_diffuse<Features>(objects, hit, objects.materials.colours[hit.shape_index]);
+	}
+	switch (objects.materials.kinds[hit.shape_index]) {
+	case MaterialKind::diffuse: [[likely]] {
+		return shade_diffuse<Features>(objects, hit, objects.materials.colours[hit.shape_index]);
+	}
+	case MaterialKind::metal: {
+		if constexpr (Features::can_shade(MaterialKind::metal)) {
+			if (specular_depth >= Features::ray_depth) [[unlikely]] {
+				return Shade{ colour };
+			}
+			const auto unit_normal = uvec_to_vec(normalise(hit.normal));
+			const auto reflected = reflect(direction, unit_normal);
+			const auto reflection = get_specular_colour<Features>(objects, reflected, hit.point, colour, specular_depth, pixel_spread);
+			return Shade{ reflection.colour.multiply(objects.materials.amounts[hit.shape_index]), reflection.direct_share };
+		}
+		break;
+	}
+	case MaterialKind::glass: {
+		if constexpr (Features::can_shade(MaterialKind::glass)) {
+			if (specular_depth >= Features::ray_depth) [[unlikely]] {
+				return Shade{ colour };
+			}
+			return shade_glass<Features>(objects, direction, hit, colour, specular_depth, pixel_spread);
+		}
+		break;
+	}
+	case MaterialKind::textured: {
+		if constexpr (Features::can_shade(MaterialKind::textured)) {
+			return shade_diffuse<Features>(objects, hit, get_texture_colour(objects, hit, pixel_spread));
+		}
+		break;
+	}
+	case MaterialKind::procedural: {
+		if constexpr (Features::can_shade(MaterialKind::procedural)) {
+			return shade_diffuse<Features>(objects, hit, get_procedural_colour(objects, hit));
+		}
+		break;
+	}
+	}
+	return Shade{ colour };
+}
+
+// The surface colour seen at a first hit as 0 to 1, mirrors by how much they reflect and glass as white.
+inline auto get_albedo(
+	const raytracer::Scene& objects,
+	const HitRecord& hit,
+	const float& pixel_spread) -> RGBf {
+	const auto to_albedo = [](const RGB& colour) { return RGBf{ colour.r / 255.0f, colour.g / 255.0f, colour.b / 255.0f }; };
+	switch (objects.materials.kinds[hit.shape_index]) {
+	case raytracer::MaterialKind::diffuse:		return to_albedo(objects.materials.colours[hit.shape_index]);
+	case raytracer::MaterialKind::textured:		return to_albedo(get_texture_colour(objects, hit, pixel_spread));
+	case raytracer::MaterialKind::procedural:	return to_albedo(get_procedural_colour(objects, hit));
+	case raytracer::MaterialKind::metal: {
+		const auto amount = objects.materials.amounts[hit.shape_index];
+		return RGBf{ amount, amount, amount };
+	}
+	default:									return RGBf{ 1,1,1 };
+	}
+}
+
+inline auto trace_primary(
+	const raytracer::Scene& objects,
+	const vec3& direction,
+	const pt3& origin) -> HitRecord {
+	thread_ray_counts.primary++;
+	thread_ray_counts.samples++;
+	RT_STAT_ADD(primary_rays, 1);
+	RT_STAT_ADD(samples, 1);
+	return find_first_hit(objects, direction, origin);
+}
+
+/*
+	Where a render loop writes AOVs, buffers is null when none are enabled. The first hit AOVs are
+	written when write_hit is set, and each sample is blended into the light AOVs as value * keep + sample * weight.
+*/
+struct AovTarget {
+	raytracer::AovBuffers* buffers = nullptr;
+	bool write_hit = false;
+	float keep = 1;
+	float weight = 0;
+};
+
+inline auto write_hit_aovs(
+	raytracer::AovBuffers& aovs,
+	const raytracer::Scene& objects,
+	const size_t& index,
+	const HitRecord& hit,
+	const float& pixel_spread) {
+	using raytracer::Aov;
+	if (aovs.enabled.contains(Aov::depth)) {
+		aovs.plane(Aov::depth, 0)[index] = hit.has_hit ? magnitude(vec_from_pts(hit.point, pt3{ 0,0,0 })) : std::numeric_limits<float>::infinity();
+	}
+	if (aovs.enabled.contains(Aov::object_id)) {
+		aovs.plane(Aov::object_id, 0)[index] = float(hit.shape_index);
+	}
+	if (!hit.has_hit) {
+		return;
+	}
+	if (aovs.enabled.contains(Aov::normal)) {
+		const auto unit_normal = normalise(hit.normal);
+		aovs.plane(Aov::normal, 0)[index] = unit_normal.i;
+		aovs.plane(Aov::normal, 1)[index] = unit_normal.j;
+		aovs.plane(Aov::normal, 2)[index] = unit_normal.k;
+	}
+	if (aovs.enabled.contains(Aov::albedo)) {
+		const auto albedo = get_albedo(objects, hit, pixel_spread);
+		aovs.plane(Aov::albedo, 0)[index] = albedo.r;
+		aovs.plane(Aov::albedo, 1)[index] = albedo.g;
+		aovs.plane(Aov::albedo, 2)[index] = albedo.b;
+	}
+}
+
+inline auto add_light_aovs(const AovTarget& aovs, const size_t& index, const Shade& shade) {
+	using raytracer::Aov;
+	const std::array<float, 3> channels = { float(shade.colour.r), float(shade.colour.g), float(shade.colour.b) };
+	const auto direct_weight = aovs.weight * shade.direct_share;
+	const auto indirect_weight = aovs.weight - direct_weight;
+	for (size_t c = 0; c < channels.size(); ++c) {
+		if (aovs.buffers->enabled.contains(Aov::direct)) {
+			auto& value = aovs.buffers->plane(Aov::direct, c)[index];
+			value = value * aovs.keep + channels[c] * direct_weight;
+		}
+		if (aovs.buffers->enabled.contains(Aov::indirect)) {
+			auto& value = aovs.buffers->plane(Aov::indirect, c)[index];
+			value = value * aovs.keep + channels[c] * indirect_weight;
+		}
 	}
 }
 
+// Kernels with AOVs are only dispatched with aovs.buffers set.
+template<typename Features>
+inline auto get_sample_colour(
+	const raytracer::Scene& objects,
+	const vec3& direction,
+	const size_t& index,
+	const float& pixel_spread,
+	const AovTarget& aovs) -> RGB {
+	const auto hit = trace_primary(objects, direction, pt3{ 0,0,0 });
+	if constexpr (!Features::has_aovs) {
+		return shade_hit<Features>(objects, direction, hit, RGB{ 0,0,0 }, 0, pixel_spread).colour;
+	}
+	if (aovs.write_hit) {
+		write_hit_aovs(*aovs.buffers, objects, index, hit, pixel_spread);
+	}
+	const auto shade = shade_hit<Features>(objects, direction, hit, RGB{ 0,0,0 }, 0, pixel_spread);
+	add_light_aovs(aovs, index, shade);
+	return shade.colour;
+}
 
 inline auto get_camera_vector(
 	const size_t& x, 
 	const size_t& y, 
 	const raytracer::Camera& camera) {
-	static const float mx = camera.get_mx();
-	static const float my = camera.get_my();
-	static const float aspect_ratio = camera.get_aspect_ratio();
-	static const float fov_adjustment = camera.get_fov_adjustment();
+	const float mx = camera.get_mx();
+	const float my = camera.get_my();
+	const float aspect_ratio = camera.get_aspect_ratio();
+	const float fov_adjustment = camera.get_fov_adjustment();
 
 	return vec3{
 		fov_adjustment * aspect_ratio * (x * mx + 1),
@@ -194,66 +521,648 @@ inline auto get_camera_vector(
 	};
 }
 
+inline auto threaded_loop(const auto& worker, const size_t& num_threads) {
+	std::vector<std::thread> threads;
+
+	for (size_t i = 0; i < num_threads; i++) {
+		threads.emplace_back(worker);
+	}
+	trace::ScopedEvent event{ "join wait" };
+	for (size_t i = num_threads; i > 0; i--) {
+		threads.back().join();
+		threads.pop_back();
+	}
+}
+
+/*
+	Threads pull tiles from a shared counter instead of owning a fixed band of rows,
+	so expensive regions of the image are spread over every thread.
+	Returns true when every tile was rendered before the control asked to stop.
+*/
+inline auto tiled_loop(
+	const std::vector<raytracer::Tile>& tiles,
+	const auto& render_tile,
+	const raytracer::RenderControl& control,
+	std::vector<uint32_t>& tile_coverage,
+	raytracer::RayCounts& total_ray_counts) -> bool
+{
+	std::atomic<size_t> next_tile = 0;
+	std::atomic<size_t> tiles_done = 0;
+	std::mutex ray_counts_mutex;
+
+	auto worker = [&]() {
+		for (size_t i = next_tile++; i < tiles.size() && !control.should_stop(); i = next_tile++) {
+			trace::ScopedEvent event{ "tile", int64_t(i) };
+			RT_STAT_TIMER(tiles);
+			render_tile(tiles[i]);
+			tile_coverage[i]++;
+			tiles_done++;
+		}
+		// Each worker is a new thread, so its counters hold just what it rendered until they are merged.
+		const auto counts = get_thread_ray_counts();
+		RT_STAT_MERGE_THREAD();
+		std::lock_guard lock{ ray_counts_mutex };
+		total_ray_counts += counts;
+	};
+	threaded_loop(worker, THREAD_COUNT);
+
+	return tiles_done == tiles.size();
+}
+
+template<typename Features>
+inline auto render_pixel(
+	const raytracer::Camera& camera,
+	const raytracer::Scene& objects,
+	const size_t& column,
+	const size_t& y,
+	raytracer::AovBuffers* aovs = nullptr) -> RGB
+{
+	const size_t x = camera.width - column;
+	const size_t index = y * camera.width + column;
+	auto direction = get_camera_vector(x, y, camera);
+
+	RGB colourAvg = {0,0,0};
+	constexpr auto SIZE = int(Features::samples_per_pixel);
+	for (size_t i = 0; i < SIZE; i++)
+	{
+		seed_sampler(0, index, i);
+		auto newColour = get_sample_colour<Features>(objects, direction, index, camera.get_pixel_spread(), AovTarget{ aovs, i == 0, 1, 1.0f / (255 * SIZE) });
+		colourAvg = {
+			newColour.r + colourAvg.r,
+			newColour.g + colourAvg.g,
+			newColour.b + colourAvg.b
+		};
+	}
+	return { 
+		colourAvg.r / SIZE,
+		colourAvg.g / SIZE,
+		colourAvg.b / SIZE,
+	};
+}
+
+inline auto add_pixel_cost(const raytracer::PixelCost& metric, std::vector<float>& pixel_cost, const size_t& index, const auto& render) {
+	if (metric == raytracer::PixelCost::none) [[likely]] {
+		render();
+	}
+	else if (metric == raytracer::PixelCost::time) {
+		const auto time_start = std::chrono::steady_clock::now();
+		render();
+		pixel_cost[index] += std::chrono::duration<float, std::nano>{ std::chrono::steady_clock::now() - time_start }.count();
+	}
+	else {
+		const auto tests_start = RT_STAT_GET(intersection_tests);
+		render();
+		pixel_cost[index] += float(RT_STAT_GET(intersection_tests) - tests_start);
+	}
+}
+
+// A primary hit waiting to be shaded, see shade_material_bins().
+struct PendingSample {
+	uint32_t index;
+	uint32_t sample;
+	vec3 direction;
+	HitRecord hit;
+};
+
+// Bin 0 holds the misses, the others one MaterialKind each.
+inline auto material_bins() -> std::array<std::vector<PendingSample>, 1 + raytracer::MATERIAL_KIND_COUNT>& {
+	thread_local std::array<std::vector<PendingSample>, 1 + raytracer::MATERIAL_KIND_COUNT> bins;
+	return bins;
+}
+
+inline auto bin_primary_sample(
+	const raytracer::Scene& objects,
+	const vec3& direction,
+	const uint32_t& index,
+	const uint32_t& sample,
+	const float& pixel_spread,
+	raytracer::AovBuffers* hit_aovs) {
+	const auto hit = trace_primary(objects, direction, pt3{ 0,0,0 });
+	if (hit_aovs != nullptr) [[unlikely]] {
+		write_hit_aovs(*hit_aovs, objects, index, hit, pixel_spread);
+	}
+	const auto bin = hit.has_hit ? 1 + size_t(objects.materials.kinds[hit.shape_index]) : 0;
+	material_bins()[bin].push_back(PendingSample{ index, sample, direction, hit });
+}
+
+/*
+	Evaluates the albedo of every procedural hit in the bin, one batch per shape so each batch runs
+	a single pattern loop. The bin is sorted by shape, albedos[i] belongs to bin[i].
+*/
+inline auto evaluate_procedural_bin(
+	const raytracer::Scene& objects,
+	std::vector<PendingSample>& bin) -> const std::vector<RGB>& {
+	thread_local std::vector<float> x, y, z;
+	thread_local std::vector<RGB> albedos;
+	std::stable_sort(bin.begin(), bin.end(), [](const auto& a, const auto& b) { return a.hit.shape_index < b.hit.shape_index; });
+
+	x.resize(bin.size());
+	y.resize(bin.size());
+	z.resize(bin.size());
+	albedos.resize(bin.size());
+	for (size_t i = 0; i < bin.size(); ++i) {
+		const auto offset = shapes::get_normal_vec(objects.spheres[bin[i].hit.shape_index], bin[i].hit.point);
+		x[i] = offset.i;
+		y[i] = offset.j;
+		z[i] = offset.k;
+	}
+	for (size_t begin = 0, end = 0; begin < bin.size(); begin = end) {
+		const auto shape_index = bin[begin].hit.shape_index;
+		while (end < bin.size() && bin[end].hit.shape_index == shape_index) {
+			++end;
+		}
+		const auto count = end - begin;
+		raytracer::evaluate_procedural(objects.materials.procedurals[shape_index],
+			std::span(x).subspan(begin, count), std::span(y).subspan(begin, count), std::span(z).subspan(begin, count),
+			std::span(albedos).subspan(begin, count));
+	}
+	return albedos;
+}
+
+/*
+	Shades the binned hits one material kind at a time, so each loop runs a single shading path
+	over the materials table instead of switching between kinds from pixel to pixel. Every sample is
+	reseeded before shading, which keeps the image identical to shading each pixel in turn.
+	Procedural albedos are evaluated for the whole bin first, their cost is not counted per pixel.
+*/
+template<typename Features>
+inline auto shade_material_bins(
+	const raytracer::Scene& objects,
+	const float& pixel_spread,
+	const uint64_t& seed,
+	const raytracer::PixelCost& metric,
+	std::vector<float>& pixel_cost,
+	const auto& on_colour) {
+	constexpr auto PROCEDURAL_BIN = 1 + size_t(raytracer::MaterialKind::procedural);
+	auto& bins = material_bins();
+	for (size_t b = 0; b < bins.size(); ++b) {
+		auto& bin = bins[b];
+		if (b == PROCEDURAL_BIN && !bin.empty()) {
+			const auto& albedos = evaluate_procedural_bin(objects, bin);
+			for (size_t i = 0; i < bin.size(); ++i) {
+				add_pixel_cost(metric, pixel_cost, bin[i].index, [&]() {
+					seed_sampler(seed, bin[i].index, bin[i].sample);
+					on_colour(bin[i], shade_diffuse<Features>(objects, bin[i].hit, albedos[i]));
+				});
+			}
+			bin.clear();
+			continue;
+		}
+		for (const auto& pending : bin) {
+			add_pixel_cost(metric, pixel_cost, pending.index, [&]() {
+				seed_sampler(seed, pending.index, pending.sample);
+				on_colour(pending, shade_hit<Features>(objects, pending.direction, pending.hit, RGB{ 0,0,0 }, 0, pixel_spread));
+			});
+		}
+		bin.clear();
+	}
+}
+
+
+// Denoising needs the albedo and normal AOVs even when they were not asked for.
+inline auto get_aov_set(const raytracer::RenderControl& control) {
+	if (control.denoise.has_value()) {
+		return control.aovs.with(raytracer::Aov::albedo).with(raytracer::Aov::normal);
+	}
+	return control.aovs;
+}
+
+// Intersection counts come from the stats counters, so without them the cost is measured as time.
+inline auto get_pixel_cost_metric(const raytracer::RenderControl& control) {
+#ifndef RAYTRACER_STATS
+	if (control.pixel_cost == raytracer::PixelCost::intersections) [[unlikely]] {
+		std::cout << "RENDER ERROR:\tCounting intersections per pixel needs a RAYTRACER_STATS build, measuring time instead\n";
+		return raytracer::PixelCost::time;
+	}
+#endif
+	return control.pixel_cost;
+}
+
+// What a tile kernel needs besides its tile, the same for every tile of a render.
+struct TileContext {
+	const raytracer::Camera& camera;
+	const raytracer::Scene& objects;
+	const raytracer::PixelCost metric;
+	std::vector<float>& pixel_cost;
+	raytracer::AovBuffers* aovs;
+};
+
+// Renders the tile a pixel at a time into colours, which holds its pixels row by row.
+template<typename Features>
+struct TileKernel {
+	static auto run(const TileContext& context, const raytracer::Tile& tile, std::span<RGB> colours) -> void {
+		const auto& camera = context.camera;
+		const auto tile_width = tile.x_end - tile.x_begin;
+		for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+			for (size_t column = tile.x_begin; column < tile.x_end; ++column) {
+				const size_t index = y * camera.width + column;
+				add_pixel_cost(context.metric, context.pixel_cost, index, [&]() {
+					colours[(y - tile.y_begin) * tile_width + column - tile.x_begin] = render_pixel<Features>(camera, context.objects, column, y, context.aovs);
+				});
+			}
+		}
+	}
+};
+
+// Traces the tile's primary rays first and then shades the hits grouped by material kind.
+template<typename Features>
+struct SortedTileKernel {
+	static auto run(const TileContext& context, const raytracer::Tile& tile, std::span<RGB> colours) -> void {
+		constexpr auto SIZE = int(Features::samples_per_pixel);
+		const auto& camera = context.camera;
+		const auto tile_width = tile.x_end - tile.x_begin;
+		std::fill(colours.begin(), colours.end(), RGB{ 0,0,0 });
+
+		for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+			for (size_t column = tile.x_begin; column < tile.x_end; ++column) {
+				const size_t index = y * camera.width + column;
+				const auto direction = get_camera_vector(camera.width - column, y, camera);
+				add_pixel_cost(context.metric, context.pixel_cost, index, [&]() {
+					for (uint32_t i = 0; i < SIZE; ++i) {
+						bin_primary_sample(context.objects, direction, uint32_t(index), i, camera.get_pixel_spread(), i == 0 ? context.aovs : nullptr);
+					}
+				});
+			}
+		}
+		const AovTarget light_aovs{ context.aovs, false, 1, 1.0f / (255 * SIZE) };
+		shade_material_bins<Features>(context.objects, camera.get_pixel_spread(), 0, context.metric, context.pixel_cost, [&](const PendingSample& pending, const Shade& shade) {
+			if constexpr (Features::has_aovs) {
+				add_light_aovs(light_aovs, pending.index, shade);
+			}
+			const auto width = size_t(camera.width);
+			auto& sum = colours[(pending.index / width - tile.y_begin) * tile_width + pending.index % width - tile.x_begin];
+			sum = RGB{ sum.r + shade.colour.r, sum.g + shade.colour.g, sum.b + shade.colour.b };
+		});
+		for (auto& sum : colours) {
+			sum = RGB{ sum.r / SIZE, sum.g / SIZE, sum.b / SIZE };
+		}
+	}
+};
+
+// Pre-instantiated for every combination of the options in kernel.h, see get_kernel_index().
+constexpr auto TILE_KERNELS = raytracer::make_kernel_table<TileKernel, raytracer::KERNEL_COUNT>();
+constexpr auto SORTED_TILE_KERNELS = raytracer::make_kernel_table<SortedTileKernel, raytracer::KERNEL_COUNT>();
+
+inline auto get_material_set(const raytracer::Scene& objects) {
+	raytracer::MaterialSet materials = 0;
+	for (const auto& kind : objects.materials.kinds) {
+		materials |= raytracer::get_material_bit(kind);
+	}
+	return materials;
+}
+
+/*
+	Picks the kernel once per render, falling back to the default for a ray depth or sample count there is none for.
+	Callers that pick one per tile report the fallback themselves, once.
+*/
+inline auto get_kernel_index(
+	const raytracer::RenderControl& control,
+	const raytracer::Scene& objects,
+	const size_t& samples_per_pixel,
+	const bool& has_aovs,
+	const bool& is_reported = true) -> size_t {
+	const auto materials = get_material_set(objects);
+	if (auto index = raytracer::get_kernel_index(control.ray_depth, samples_per_pixel, materials, has_aovs)) [[likely]] {
+		return *index;
+	}
+	const auto is_compiled = [](const auto& values, const size_t& value) { return std::find(values.begin(), values.end(), value) != values.end(); };
+	const auto ray_depth = is_compiled(raytracer::KERNEL_RAY_DEPTHS, control.ray_depth) ? control.ray_depth : raytracer::DEFAULT_RAY_DEPTH;
+	const auto samples = is_compiled(raytracer::KERNEL_SAMPLE_COUNTS, samples_per_pixel) ? samples_per_pixel : raytracer::DEFAULT_SAMPLES_PER_PIXEL;
+	if (is_reported) {
+		std::cout << "RENDER ERROR:\tNo kernel for a ray depth of " << control.ray_depth << " with " << samples_per_pixel
+			<< " samples per pixel, using " << ray_depth << " and " << samples << "\n";
+	}
+	return *raytracer::get_kernel_index(ray_depth, samples, materials, has_aovs);
+}
+
+// The kernels only know RGB, each tile is encoded into the framebuffer's format once it is done.
+template<typename Pixel>
 inline auto render_loop(
 	const raytracer::Camera& camera, 
-	const raytracer::Scene& objects)
+	const raytracer::Scene& objects,
+	const raytracer::RenderControl& control,
+	std::span<Pixel> pixels)
 {
-	std::vector<RGB> pixels;
-	pixels.resize(camera.height * camera.width);
-
-	RGB colour = { 0,0,0 };
-	auto partial_loop = [&](size_t start, size_t end) {
-		HitRecord hit;
-		auto colour = RGB{ 0,0,0 };
-		int index = start * camera.width;
-
-		for (size_t y = start; y < end; ++y) {
-			for (size_t x = camera.width; x > 0; --x) {
-				auto direction = get_camera_vector(x, y, camera);
-
-				RGB colourAvg = {0,0,0};
-				constexpr auto SIZE = 2;
-				for (size_t i = 0; i < SIZE; i++)
-				{
-					auto newColour = get_colour(objects, direction, pt3{ 0,0,0 }, RGB{ 0,0,0 });
-					colourAvg = {
-						newColour.r + colourAvg.r,
-						newColour.g + colourAvg.g,
-						newColour.b + colourAvg.b
-					};
-				}
-				colour = { 
-					colourAvg.r / SIZE,
-					colourAvg.g / SIZE,
-					colourAvg.b / SIZE,
-				};
-
-				pixels[index] = colour;
-				index++;
-			}
+	raytracer::RenderResult result{ {}, raytracer::make_tiles(camera, control.regions) };
+	result.tile_coverage.resize(result.tiles.size(), 0);
+
+	if (control.pixel_cost != raytracer::PixelCost::none) {
+		result.pixel_cost.resize(pixels.size(), 0);
+	}
+	result.aovs = raytracer::AovBuffers(get_aov_set(control), camera.width, camera.height);
+	auto* aovs = result.aovs.enabled.empty() ? nullptr : &result.aovs;
+
+	const auto kernel_index = get_kernel_index(control, objects, control.samples_per_pixel, aovs != nullptr);
+	const auto kernel = control.sort_by_material ? SORTED_TILE_KERNELS[kernel_index] : TILE_KERNELS[kernel_index];
+	const TileContext context{ camera, objects, get_pixel_cost_metric(control), result.pixel_cost, aovs };
+	auto render_tile = [&](const raytracer::Tile& tile) {
+		thread_local std::vector<RGB> colours;
+		const auto tile_width = tile.x_end - tile.x_begin;
+		colours.resize(tile_width * (tile.y_end - tile.y_begin));
+		kernel(context, tile, colours);
+		for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+			raytracer::convert_pixels(std::span<const RGB>(colours).subspan((y - tile.y_begin) * tile_width, tile_width),
+				pixels.subspan(y * camera.width + tile.x_begin, tile_width));
 		}
+	};
+
+	result.is_complete = tiled_loop(result.tiles, render_tile, control, result.tile_coverage, result.ray_counts);
+	result.passes = result.is_complete ? 1 : 0;
+
+	return result;
+}
 
+// Denoises the whole frame but only writes back the pixels of the tiles, like the render itself.
+template<typename Pixel>
+inline auto denoise_pixels(
+	const raytracer::Camera& camera,
+	const raytracer::DenoiseSettings& settings,
+	const raytracer::RenderResult& result,
+	std::span<Pixel> pixels) {
+	std::vector<RGBf> colour(pixels.size());
+	raytracer::convert_pixels(std::span<const Pixel>(pixels), std::span<RGBf>(colour));
+	const auto get_planes = [&](const raytracer::Aov& aov) {
+		return raytracer::PlaneSpans{ result.aovs.plane(aov, 0), result.aovs.plane(aov, 1), result.aovs.plane(aov, 2) };
 	};
+	const auto denoised = raytracer::denoise(colour, get_planes(raytracer::Aov::albedo), get_planes(raytracer::Aov::normal), camera.width, camera.height, settings);
+	for (const auto& tile : result.tiles) {
+		for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+			const auto begin = y * camera.width + tile.x_begin;
+			const auto count = tile.x_end - tile.x_begin;
+			raytracer::convert_pixels(std::span<const RGBf>(denoised).subspan(begin, count), pixels.subspan(begin, count));
+		}
+	}
+}
+
+template<typename Pixel>
+inline auto apply_post_passes(
+	const raytracer::Camera& camera,
+	const raytracer::RenderControl& control,
+	raytracer::RenderResult& result,
+	std::span<Pixel> pixels) {
+	if (control.denoise.has_value() && result.is_complete) [[unlikely]] {
+		denoise_pixels(camera, *control.denoise, result, pixels);
+	}
+}
+
+// What a progressive pass kernel needs besides its tile, passes_done is the count a resumed render started from.
+struct PassContext {
+	const raytracer::Camera& camera;
+	const raytracer::Scene& objects;
+	const raytracer::RenderControl& control;
+	const raytracer::PixelCost metric;
+	std::vector<float>& pixel_cost;
+	raytracer::AovBuffers* aovs;
+	raytracer::Accumulator& accumulator;
+	uint64_t seed;
+	size_t pass;
+	size_t passes_done;
+};
+
+// Adds one sample to every pixel of the tile that has fewer than pass, shading the hits by material kind when sorted.
+template<typename Features, bool IS_SORTED>
+inline auto render_tile_pass(const PassContext& context, const raytracer::Tile& tile) -> void {
+	const auto& camera = context.camera;
+	const auto& objects = context.objects;
+	auto& accumulator = context.accumulator;
+	// The light AOVs are the mean of the passes rendered since starting or resuming.
+	const auto run_pass = float(context.pass - context.passes_done);
+	const AovTarget pass_aovs{ context.aovs, context.pass == context.passes_done + 1, (run_pass - 1) / run_pass, 1 / (255 * run_pass) };
+	for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+		for (size_t column = tile.x_begin; column < tile.x_end; ++column) {
+			const size_t index = y * camera.width + column;
+			if (accumulator.sample_count[index] >= context.pass) {
+				continue;
+			}
+			const size_t x = camera.width - column;
+			const auto direction = get_camera_vector(x, y, camera);
+			if constexpr (IS_SORTED) {
+				add_pixel_cost(context.metric, context.pixel_cost, index, [&]() {
+					bin_primary_sample(objects, direction, uint32_t(index), accumulator.sample_count[index], camera.get_pixel_spread(),
+						pass_aovs.write_hit ? context.aovs : nullptr);
+				});
+			}
+			else {
+				add_pixel_cost(context.metric, context.pixel_cost, index, [&]() {
+					seed_sampler(context.seed, index, accumulator.sample_count[index]);
+					accumulator.add_sample(index, get_sample_colour<Features>(objects, direction, index, camera.get_pixel_spread(), pass_aovs));
+				});
+			}
+		}
+	}
+	if constexpr (IS_SORTED) {
+		shade_material_bins<Features>(objects, camera.get_pixel_spread(), context.seed, context.metric, context.pixel_cost, [&](const PendingSample& pending, const Shade& shade) {
+			if constexpr (Features::has_aovs) {
+				add_light_aovs(pass_aovs, pending.index, shade);
+			}
+			accumulator.add_sample(pending.index, shade.colour);
+			});
+		}
+}
+
+template<typename Features>
+struct PassKernel {
+	static auto run(const PassContext& context, const raytracer::Tile& tile) -> void {
+		render_tile_pass<Features, false>(context, tile);
+	}
+};
+template<typename Features>
+struct SortedPassKernel {
+	static auto run(const PassContext& context, const raytracer::Tile& tile) -> void {
+		render_tile_pass<Features, true>(context, tile);
+	}
+};
 
-	auto threaded_loop = [&](int num_threads) {
-		std::vector<std::thread> threads;
+// Only the kernels that take one sample per pixel.
+constexpr auto PASS_KERNELS = raytracer::make_kernel_table<PassKernel, raytracer::PASS_KERNEL_COUNT>();
+constexpr auto SORTED_PASS_KERNELS = raytracer::make_kernel_table<SortedPassKernel, raytracer::PASS_KERNEL_COUNT>();
 
-		for (size_t i = 0; i < num_threads; i++) {
-			threads.emplace_back(partial_loop, i * camera.height / num_threads, (1+i) * camera.height / num_threads);
+// The fewest samples of any pixel in the tiles, pixels outside the regions are never sampled and don't count.
+inline auto get_passes_done(const raytracer::Accumulator& accumulator, const std::vector<raytracer::Tile>& tiles, const size_t& width) -> size_t {
+	if (tiles.empty()) {
+		return 0;
+	}
+	auto passes_done = std::numeric_limits<uint32_t>::max();
+	for (const auto& tile : tiles) {
+		for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+			const auto row = accumulator.sample_count.begin() + y * width;
+			passes_done = std::min(passes_done, *std::min_element(row + tile.x_begin, row + tile.x_end));
 		}
-		for (size_t i = num_threads; i > 0; i--) {
-			threads.back().join();
-			threads.pop_back();
+	}
+	return passes_done;
+}
+
+template<typename Pixel>
+inline auto progressive_render_loop(
+	const raytracer::Camera& camera,
+	const raytracer::Scene& objects,
+	const raytracer::ProgressiveSettings& settings,
+	const raytracer::RenderControl& control,
+	std::span<Pixel> pixels)
+{
+	using clock = std::chrono::high_resolution_clock;
+
+	raytracer::Accumulator accumulator(camera.height * camera.width);
+	raytracer::RenderResult result{ {}, raytracer::make_tiles(camera, control.regions) };
+	result.tile_coverage.resize(result.tiles.size(), 0);
+
+	const auto is_checkpointing = !settings.checkpoint_path.empty();
+	if (is_checkpointing && settings.resume) {
+		auto checkpoint = raytracer::read_checkpoint(settings.checkpoint_path);
+		if (!checkpoint.has_value()) {
+			std::cout << "CHECKPOINT ERROR:\tCould not read " << settings.checkpoint_path << ", starting from scratch\n";
+		}
+		else if (checkpoint->width != uint32_t(camera.width) || checkpoint->height != uint32_t(camera.height) || checkpoint->seed != settings.seed) {
+			std::cout << "CHECKPOINT ERROR:\t" << settings.checkpoint_path << " is for a different render, starting from scratch\n";
 		}
+		else {
+			accumulator = std::move(checkpoint->accumulator);
+		}
+	}
+	const auto get_checkpoint = [&]() {
+		return raytracer::Checkpoint{ uint32_t(camera.width), uint32_t(camera.height), settings.seed, accumulator };
 	};
+	std::optional<raytracer::CheckpointWriter> checkpoint_writer;
+	if (is_checkpointing) {
+		checkpoint_writer.emplace(settings.checkpoint_path);
+	}
+	if (control.pixel_cost != raytracer::PixelCost::none) {
+		result.pixel_cost.resize(accumulator.colour_sum.size(), 0);
+	}
+	const size_t passes_done = get_passes_done(accumulator, result.tiles, camera.width);
+	size_t pass = passes_done + 1;
+	result.aovs = raytracer::AovBuffers(get_aov_set(control), camera.width, camera.height);
+	auto* aovs = result.aovs.enabled.empty() ? nullptr : &result.aovs;
 
-	threaded_loop(10);
+	const auto kernel_index = get_kernel_index(control, objects, 1, aovs != nullptr);
+	const auto kernel = control.sort_by_material ? SORTED_PASS_KERNELS[kernel_index] : PASS_KERNELS[kernel_index];
+	const auto metric = get_pixel_cost_metric(control);
+	auto render_tile_pass = [&](const raytracer::Tile& tile) {
+		kernel(PassContext{ camera, objects, control, metric, result.pixel_cost, aovs, accumulator, settings.seed, pass, passes_done }, tile);
+	};
 
+	const auto time_start = clock::now();
+	auto time_last_preview = time_start;
+	auto time_last_checkpoint = time_start;
 
-	return pixels;
+	if (passes_done >= settings.max_passes) {
+		result.passes = passes_done;
+		result.is_complete = true;
+	}
+	for (; pass <= settings.max_passes; ++pass) {
+		trace::ScopedEvent event{ "pass", int64_t(pass) };
+		RT_STAT_TIMER(passes);
+		if (!tiled_loop(result.tiles, render_tile_pass, control, result.tile_coverage, result.ray_counts)) [[unlikely]] {
+			result.passes = pass - 1;
+			result.is_complete = false;
+			break;
+		}
+
+		const auto time_now = clock::now();
+		const auto is_out_of_time = settings.time_budget.count() > 0 
+			&& time_now - time_start >= settings.time_budget;
+		const auto is_converged = settings.noise_threshold > 0 && pass > 1
+			&& accumulator.mean_relative_error() < settings.noise_threshold;
+		const auto is_final_pass = pass == settings.max_passes || is_out_of_time || is_converged;
+
+		if (settings.on_preview && !is_final_pass) {
+			const auto is_pass_due = settings.preview_pass_interval > 0 
+				&& pass % settings.preview_pass_interval == 0;
+			const auto is_time_due = settings.preview_time_interval.count() > 0 
+				&& time_now - time_last_preview >= settings.preview_time_interval;
+
+			if (pass == 1 || is_pass_due || is_time_due) {
+				trace::ScopedEvent preview_event{ "preview" };
+				accumulator.resolve(pixels);
+				settings.on_preview(std::span<const Pixel>(pixels), pass);
+				time_last_preview = clock::now();
+			}
+		}
+		if (is_checkpointing && !is_final_pass) {
+			const auto is_pass_due = settings.checkpoint_pass_interval > 0
+				&& pass % settings.checkpoint_pass_interval == 0;
+			const auto is_time_due = settings.checkpoint_time_interval.count() > 0
+				&& time_now - time_last_checkpoint >= settings.checkpoint_time_interval;
+
+			if (is_pass_due || is_time_due) {
+				checkpoint_writer->submit(get_checkpoint());
+				time_last_checkpoint = clock::now();
+			}
+		}
+		if (is_final_pass) {
+			result.passes = pass;
+			result.is_complete = true;
+			break;
+		}
+	}
+
+	if (is_checkpointing) {
+		checkpoint_writer->submit(get_checkpoint());
+	}
+	accumulator.resolve(pixels);
+	return result;
+}
+
+auto raytracer::MaterialTable::add(const Material& material) -> void
+{
+	std::visit([&](const auto& value) {
+		using Value = std::decay_t<decltype(value)>;
+		if constexpr (std::is_same_v<Value, RGB>) {
+			kinds.push_back(MaterialKind::diffuse);
+			colours.push_back(value);
+			amounts.push_back(0);
+			refractive_indices.push_back(1);
+			textures.push_back(0);
+			procedurals.push_back(ProceduralTexture{});
+		}
+		else if constexpr (std::is_same_v<Value, Metal>) {
+			kinds.push_back(MaterialKind::metal);
+			colours.push_back(RGB{ 0,0,0 });
+			amounts.push_back(value.reflect_amount);
+			refractive_indices.push_back(1);
+			textures.push_back(0);
+			procedurals.push_back(ProceduralTexture{});
+		}
+		else if constexpr (std::is_same_v<Value, Glass>) {
+			kinds.push_back(MaterialKind::glass);
+			colours.push_back(RGB{ 0,0,0 });
+			amounts.push_back(value.blur_amount);
+			refractive_indices.push_back(value.refractive_index);
+			textures.push_back(0);
+			procedurals.push_back(ProceduralTexture{});
+		}
+		else if constexpr (std::is_same_v<Value, ImageTexture>) {
+			kinds.push_back(MaterialKind::textured);
+			colours.push_back(RGB{ 0,0,0 });
+			amounts.push_back(0);
+			refractive_indices.push_back(1);
+			textures.push_back(value.texture);
+			procedurals.push_back(ProceduralTexture{});
+		}
+		else {
+			kinds.push_back(MaterialKind::procedural);
+			colours.push_back(RGB{ 0,0,0 });
+			amounts.push_back(0);
+			refractive_indices.push_back(1);
+			textures.push_back(0);
+			procedurals.push_back(value);
+		}
+	}, material);
 }
 
-auto raytracer::render(const Camera& camera) -> std::vector<RGB>
+auto raytracer::Scene::load_texture(const std::string& image_path) -> std::optional<ImageTexture>
+{
+	if (!textures) {
+		textures = std::make_shared<TextureCache>();
+	}
+	const auto texture = textures->add(image_path);
+	if (!texture.has_value()) {
+		return {};
+	}
+	return ImageTexture{ *texture };
+}
+
+auto raytracer::make_default_scene() -> Scene
 {
 	raytracer::Scene objects;
 
@@ -272,53 +1181,350 @@ auto raytracer::render(const Camera& camera) -> std::vector<RGB>
 
 	objects.point_lights.emplace_back(-1, 10, 0);
 
+	return objects;
+}
+
+inline auto intersect(const raytracer::Tile& a, const raytracer::Tile& b) -> std::optional<raytracer::Tile> {
+	const raytracer::Tile overlap{
+		std::max(a.x_begin, b.x_begin), std::max(a.y_begin, b.y_begin),
+		std::min(a.x_end, b.x_end), std::min(a.y_end, b.y_end)
+	};
+	if (overlap.x_begin >= overlap.x_end || overlap.y_begin >= overlap.y_end) [[likely]] {
+		return {};
+	}
+	return overlap;
+}
+
+// Splits the part of a not covered by b into at most four rectangles.
+inline auto subtract(const raytracer::Tile& a, const raytracer::Tile& b, std::vector<raytracer::Tile>& remainder) {
+	const auto overlap = intersect(a, b);
+	if (!overlap.has_value()) {
+		remainder.push_back(a);
+		return;
+	}
+	if (a.y_begin < overlap->y_begin) {
+		remainder.emplace_back(a.x_begin, a.y_begin, a.x_end, overlap->y_begin);
+	}
+	if (overlap->y_end < a.y_end) {
+		remainder.emplace_back(a.x_begin, overlap->y_end, a.x_end, a.y_end);
+	}
+	if (a.x_begin < overlap->x_begin) {
+		remainder.emplace_back(a.x_begin, overlap->y_begin, overlap->x_begin, overlap->y_end);
+	}
+	if (overlap->x_end < a.x_end) {
+		remainder.emplace_back(overlap->x_end, overlap->y_begin, a.x_end, overlap->y_end);
+	}
+}
+
+auto raytracer::render_tile(const Camera& camera, const Scene& objects, const Tile& tile, const RenderControl& control) -> std::vector<RGB>
+{
+	const auto kernel_index = ::get_kernel_index(control, objects, control.samples_per_pixel, false, false);
+	const auto kernel = control.sort_by_material ? SORTED_TILE_KERNELS[kernel_index] : TILE_KERNELS[kernel_index];
+	std::vector<float> no_pixel_cost;
+	std::vector<RGB> pixels((tile.x_end - tile.x_begin) * (tile.y_end - tile.y_begin));
+	kernel(TileContext{ camera, objects, PixelCost::none, no_pixel_cost, nullptr }, tile, pixels);
+	return pixels;
+}
+
+auto raytracer::is_valid_region(const Camera& camera, const Tile& region) -> bool
+{
+	return region.x_begin < region.x_end && region.x_end <= size_t(camera.width)
+		&& region.y_begin < region.y_end && region.y_end <= size_t(camera.height);
+}
+
+auto raytracer::make_tiles(const Camera& camera, const std::vector<Tile>& regions) -> std::vector<Tile>
+{
+	std::vector<Tile> tiles;
+	std::vector<Tile> pieces;
+	std::vector<Tile> remainder;
+
+	for (size_t y = 0; y < size_t(camera.height); y += TILE_SIZE) {
+		for (size_t x = 0; x < size_t(camera.width); x += TILE_SIZE) {
+			const auto tile = Tile{
+				x, y,
+				std::min(x + TILE_SIZE, size_t(camera.width)),
+				std::min(y + TILE_SIZE, size_t(camera.height))
+			};
+			if (regions.empty()) [[likely]] {
+				tiles.push_back(tile);
+				continue;
+			}
+
+			const auto first_piece = tiles.size();
+			for (const auto& region : regions) {
+				const auto clipped = intersect(tile, region);
+				if (!clipped.has_value()) {
+					continue;
+				}
+				pieces = { *clipped };
+				for (size_t i = first_piece; i < tiles.size(); ++i) {
+					remainder.clear();
+					for (const auto& piece : pieces) {
+						subtract(piece, tiles[i], remainder);
+					}
+					std::swap(pieces, remainder);
+				}
+				tiles.insert(tiles.end(), pieces.begin(), pieces.end());
+			}
+		}
+	}
+	return tiles;
+}
+
+auto raytracer::make_heatmap(const std::vector<float>& pixel_cost) -> std::vector<RGB>
+{
+	constexpr std::array<RGBf, 5> RAMP = { RGBf{ 0,0,0 }, RGBf{ 0,0,255 }, RGBf{ 0,255,0 }, RGBf{ 255,255,0 }, RGBf{ 255,0,0 } };
+
+	if (pixel_cost.empty()) {
+		return {};
+	}
+	auto sorted_cost = pixel_cost;
+	const auto percentile = sorted_cost.begin() + size_t(0.99 * (sorted_cost.size() - 1));
+	std::nth_element(sorted_cost.begin(), percentile, sorted_cost.end());
+	const auto scale = *percentile <= 0 ? 1.0f : *percentile;
+
+	std::vector<RGB> heatmap;
+	heatmap.reserve(pixel_cost.size());
+	for (const auto& cost : pixel_cost) {
+		const auto position = std::clamp(cost / scale, 0.0f, 1.0f) * (RAMP.size() - 1);
+		const auto low = std::min(size_t(position), RAMP.size() - 2);
+		const auto blend = position - low;
+		heatmap.push_back(RGB{
+			int(RAMP[low].r + blend * (RAMP[low + 1].r - RAMP[low].r)),
+			int(RAMP[low].g + blend * (RAMP[low + 1].g - RAMP[low].g)),
+			int(RAMP[low].b + blend * (RAMP[low + 1].b - RAMP[low].b))
+		});
+	}
+	return heatmap;
+}
+
+template<typename Pixel>
+auto raytracer::write_ppm(const std::string& file_name, const ImageView<Pixel>& image) -> bool
+{
+	RT_STAT_TIMER(output);
+	trace::ScopedEvent event{ "output encoding" };
+	std::ofstream output_file{ file_name, std::ios::binary };
+	output_file << "P3\n";
+	output_file << image.width << " " << image.height << "\n255\n";
+
+	// Each row is formatted into one reused buffer and written with a single call.
+	constexpr size_t MAX_CHANNEL_CHARS = 12;
+	std::vector<char> line(image.width * 3 * MAX_CHANNEL_CHARS);
+	std::vector<RGB> converted_row(std::is_same_v<Pixel, RGB> ? 0 : image.width);
+	const auto get_row = [&](const size_t& y) -> std::span<const RGB> {
+		if constexpr (std::is_same_v<Pixel, RGB>) {
+			return image.row(y);
+		}
+		else {
+			convert_pixels(image.row(y), std::span<RGB>(converted_row));
+			return converted_row;
+		}
+	};
+	// Values outside 0 to 255 are clamped, and reported once for the whole image.
+	size_t clamped_count = 0;
+	for (size_t y = 0; y < image.height; ++y) {
+		auto* end = line.data();
+		for (const auto& rgb : get_row(y)) {
+			for (const auto& channel : { rgb.r, rgb.g, rgb.b }) {
+				const auto value = std::clamp(channel, 0, 255);
+				clamped_count += value != channel;
+				end = std::to_chars(end, end + MAX_CHANNEL_CHARS, value).ptr;
+				*end++ = ' ';
+			}
+		}
+		output_file.write(line.data(), end - line.data());
+	}
+	if (clamped_count > 0) [[unlikely]] {
+		std::cout << ".PPM ERROR:\t" << clamped_count << " channel values outside 0 to 255 were clamped in " << file_name << "\n";
+	}
+	return bool(output_file);
+}
+
+inline auto load_default_scene() {
+	trace::ScopedEvent event{ "scene load" };
+	return raytracer::make_default_scene();
+}
+
+template<typename Pixel>
+inline auto is_frame_sized(const raytracer::Camera& camera, const std::span<Pixel>& pixels) {
+	if (pixels.size() != size_t(camera.width) * camera.height) [[unlikely]] {
+		std::cout << "RENDER ERROR:\tBuffer holds " << pixels.size() << " pixels when it should be: " << camera.width * camera.height << "\n";
+		return false;
+	}
+	return true;
+}
+
+inline auto has_valid_regions(const raytracer::Camera& camera, const raytracer::RenderControl& control) {
+	for (const auto& region : control.regions) {
+		if (!raytracer::is_valid_region(camera, region)) [[unlikely]] {
+			std::cout << "RENDER ERROR:\tRegion " << region.x_begin << "," << region.y_begin << "," << region.x_end << "," << region.y_end
+				<< " is not inside the " << camera.width << "x" << camera.height << " frame\n";
+			return false;
+		}
+	}
+	return true;
+}
+
+auto raytracer::render(const Camera& camera, const RenderControl& control) -> RenderResult
+{
+	return render(camera, load_default_scene(), control);
+}
 
+auto raytracer::render(const Camera& camera, const Scene& objects, const RenderControl& control) -> RenderResult
+{
+	std::vector<RGB> pixels(camera.height * camera.width, RGB{ 0,0,0 });
+	auto result = render(camera, objects, pixels, control);
+	result.pixels = std::move(pixels);
+	return result;
+}
 
+template<typename Pixel>
+auto raytracer::render(const Camera& camera, const Scene& objects, std::span<Pixel> pixels, const RenderControl& control) -> RenderResult
+{
+	if (!is_frame_sized(camera, pixels) || !has_valid_regions(camera, control)) [[unlikely]] {
+		return RenderResult{ .is_complete = false };
+	}
 	auto time_render_start = std::chrono::high_resolution_clock::now();
 
-	std::vector<RGB> pixels = render_loop(camera, objects);
+	auto result = render_loop(camera, objects, control, pixels);
+	apply_post_passes(camera, control, result, pixels);
 
 	auto time_render_end = std::chrono::high_resolution_clock::now();
-	auto time_render = std::chrono::duration<double, std::milli>{ time_render_end - time_render_start };
-	std::cout << "Render Time = " << time_render << "\n";
+	result.render_time = std::chrono::duration<double, std::milli>{ time_render_end - time_render_start };
+
+	return result;
+}
 
+auto raytracer::render(const Camera& camera, const ProgressiveSettings& settings, const RenderControl& control) -> RenderResult
+{
+	return render(camera, load_default_scene(), settings, control);
+}
+
+auto raytracer::render(const Camera& camera, const Scene& objects, const ProgressiveSettings& settings, const RenderControl& control) -> RenderResult
+{
+	std::vector<RGB> pixels(camera.height * camera.width, RGB{ 0,0,0 });
+	auto result = render(camera, objects, settings, pixels, control);
+	result.pixels = std::move(pixels);
+	return result;
+}
+
+template<typename Pixel>
+auto raytracer::render(const Camera& camera, const Scene& objects, const ProgressiveSettings& settings, std::span<Pixel> pixels, const RenderControl& control) -> RenderResult
+{
+	if (!is_frame_sized(camera, pixels) || !has_valid_regions(camera, control)) [[unlikely]] {
+		return RenderResult{ .is_complete = false };
+	}
+	auto time_render_start = std::chrono::high_resolution_clock::now();
+
+	auto result = progressive_render_loop(camera, objects, settings, control, pixels);
+	apply_post_passes(camera, control, result, pixels);
+
+	auto time_render_end = std::chrono::high_resolution_clock::now();
+	result.render_time = std::chrono::duration<double, std::milli>{ time_render_end - time_render_start };
+
+	return result;
+}
+
+auto raytracer::RayCounts::operator+=(const RayCounts& other) -> RayCounts&
+{
+	primary += other.primary;
+	bounce += other.bounce;
+	shadow += other.shadow;
+	samples += other.samples;
+	intersection_tests += other.intersection_tests;
+	return *this;
+}
+
+raytracer::Accumulator::Accumulator(const size_t& pixel_count)
+	: colour_sum(pixel_count, RGBf{ 0,0,0 }), luminance_sq_sum(pixel_count, 0), sample_count(pixel_count, 0)
+{}
+
+auto raytracer::Accumulator::add_sample(const size_t& index, const RGB& colour) -> void
+{
+	const auto luminance = 0.2126f * colour.r + 0.7152f * colour.g + 0.0722f * colour.b;
+	colour_sum[index].r += colour.r;
+	colour_sum[index].g += colour.g;
+	colour_sum[index].b += colour.b;
+	luminance_sq_sum[index] += luminance * luminance;
+	sample_count[index]++;
+}
+
+auto raytracer::Accumulator::resolve() const -> std::vector<RGB>
+{
+	std::vector<RGB> pixels(colour_sum.size(), RGB{ 0,0,0 });
+	resolve(std::span<RGB>(pixels));
 	return pixels;
 }
 
+template<typename Pixel>
+auto raytracer::Accumulator::resolve(std::span<Pixel> pixels) const -> void
+{
+	for (size_t i = 0; i < colour_sum.size(); ++i) {
+		if (sample_count[i] == 0) [[unlikely]] {
+			continue;
+		}
+		const auto n = float(sample_count[i]);
+		// 8-bit formats keep the whole steps of the renderer's own colours, wider ones get the mean itself.
+		if constexpr (std::is_same_v<Pixel, RGB> || std::is_same_v<Pixel, RGB8> || std::is_same_v<Pixel, RGBA8>) {
+			pixels[i] = encode<Pixel>(RGB{
+				int(colour_sum[i].r / n),
+				int(colour_sum[i].g / n),
+				int(colour_sum[i].b / n)
+			});
+		}
+		else {
+			const auto scale = 1.0f / (255 * n);
+			pixels[i] = PixelTraits<Pixel>::encode(RGBf{ colour_sum[i].r * scale, colour_sum[i].g * scale, colour_sum[i].b * scale });
+		}
+	}
+}
+
+/*
+	Standard error of each pixel's mean luminance, relative to that luminance, averaged over the sampled pixels.
+	Dark pixels are measured against a floor of 1 so black background does not dominate.
+*/
+auto raytracer::Accumulator::mean_relative_error() const -> float
+{
+	double error_sum = 0;
+	size_t sampled_count = 0;
+	for (size_t i = 0; i < colour_sum.size(); ++i) {
+		const auto n = float(sample_count[i]);
+		if (n == 0) {
+			continue;
+		}
+		if (n < 2) [[unlikely]] {
+			return std::numeric_limits<float>::max();
+		}
+		sampled_count++;
+		const auto mean = (0.2126f * colour_sum[i].r + 0.7152f * colour_sum[i].g + 0.0722f * colour_sum[i].b) / n;
+		const auto variance = std::max(luminance_sq_sum[i] / n - mean * mean, 0.0f);
+		error_sum += sqrt(variance / n) / std::max(mean, 1.0f);
+	}
+	return sampled_count > 0 ? float(error_sum / sampled_count) : std::numeric_limits<float>::max();
+}
+
 PPM::PPM(
 	const std::string& file_name, 
 	const int& width, 
 	const int& height)
-	: file_name_(file_name), width_(width), height_(height)
+	: file_name_(file_name), width_(width), height_(height), colour_info(width * height, RGB{ 0,0,0 })
 {
-	colour_info.reserve(width_ * height_);
 }
 
 auto PPM::create_ppm() -> void
 {
-	if (colour_info.size() < width_ * height_) {
+	if (colour_info.size() < size_t(width_) * height_) {
 		std::cout << ".PPM ERROR:\tColour data is not complete\n";
 		std::cout << colour_info.size() << " when should be: " << width_ * height_ << '\n';
 	}
-	if (colour_info.size() > width_ * height_) {
+	if (colour_info.size() > size_t(width_) * height_) {
 		std::cout << ".PPM ERROR:\tColour data is too big\n";
 		std::cout << colour_info.size() << " when should be: " << width_ * height_ << '\n';
 	}
-	std::ofstream output_file{ file_name_ };
-	output_file << "P3\n";
-	output_file << width_ << " " << height_ << "\n255\n";
-	for(const auto& rgb : colour_info)
-	{
-		if (rgb.r > 255 || rgb.g > 255 || rgb.g > 255) {
-			std::cout << "invalid- to big\n";
-		}
-		if (rgb.r < 0 || rgb.g < 0 || rgb.g < 0) {
-			std::cout << "invalid - to small\n";
-		}
-		output_file << std::to_string(rgb.r) << " " << std::to_string(rgb.g) << " " << std::to_string(rgb.b) << " ";
+	const auto row_count = std::min(colour_info.size() / std::max(width_, 1), size_t(height_));
+	if (!raytracer::write_ppm(file_name_, raytracer::ImageView<RGB>{ colour_info, size_t(width_), row_count })) {
+		std::cout << ".PPM ERROR:\tCould not write " << file_name_ << '\n';
 	}
-
-	output_file.close();
 }
 
 void PPM::change_dimensions(
@@ -328,4 +1534,16 @@ void PPM::change_dimensions(
 	width_ = width;
 	height_ = height;
 	colour_info.resize(width_ * height_);
-}
\ No newline at end of file
+}
+#define RT_INSTANTIATE_PIXEL_FORMAT(Pixel) \
+	template auto raytracer::write_ppm(const std::string& file_name, const ImageView<Pixel>& image) -> bool; \
+	template auto raytracer::Accumulator::resolve(std::span<Pixel> pixels) const -> void; \
+	template auto raytracer::render(const Camera& camera, const Scene& objects, std::span<Pixel> pixels, const RenderControl& control) -> RenderResult; \
+	template auto raytracer::render(const Camera& camera, const Scene& objects, const ProgressiveSettings& settings, std::span<Pixel> pixels, const RenderControl& control) -> RenderResult;
+
+RT_INSTANTIATE_PIXEL_FORMAT(RGB)
+RT_INSTANTIATE_PIXEL_FORMAT(RGB8)
+RT_INSTANTIATE_PIXEL_FORMAT(RGBA8)
+RT_INSTANTIATE_PIXEL_FORMAT(RGB16)
+RT_INSTANTIATE_PIXEL_FORMAT(RGBh)
+RT_INSTANTIATE_PIXEL_FORMAT(RGBf)
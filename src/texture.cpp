@@ -0,0 +1,457 @@
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <cmath>
+#include <sstream>
+#include <functional>
+
+#include "texture.h"
+#include "trace.h"
+
+constexpr std::array<char, 4> TEXTURE_MAGIC = { 'R', 'T', 'T', 'X' };
+constexpr uint32_t TEXTURE_VERSION = 1;
+constexpr size_t HEADER_SIZE = sizeof(TEXTURE_MAGIC) + 3 * sizeof(uint32_t);
+constexpr size_t TILE_BYTES = sizeof(raytracer::TextureTile);
+
+struct Image {
+	size_t width;
+	size_t height;
+	std::vector<RGB8> texels;
+};
+
+inline auto read_token(std::istream& file) {
+	std::string token;
+	while (file >> token && token[0] == '#') {
+		std::getline(file, token);
+	}
+	return token;
+}
+
+// An open PPM positioned at its first row, see open_ppm().
+struct PpmStream {
+	std::ifstream file;
+	bool is_binary;
+	size_t width;
+	size_t height;
+	int max_value;
+};
+
+// Opens binary (P6) and plain (P3) PPMs and reads their header, the rows are read with read_ppm_rows().
+inline auto open_ppm(const std::string& path) -> std::optional<PpmStream> {
+	PpmStream ppm{ std::ifstream{ path, std::ios::binary } };
+	const auto type = read_token(ppm.file);
+	if (type != "P3" && type != "P6") {
+		return {};
+	}
+	ppm.is_binary = type == "P6";
+	try {
+		ppm.width = std::stoul(read_token(ppm.file));
+		ppm.height = std::stoul(read_token(ppm.file));
+		ppm.max_value = std::stoi(read_token(ppm.file));
+	}
+	catch (...) {
+		return {};
+	}
+	if (ppm.width == 0 || ppm.height == 0 || ppm.max_value <= 0 || ppm.max_value > 65535) {
+		return {};
+	}
+	if (ppm.is_binary) {
+		ppm.file.get();
+	}
+	return ppm;
+}
+
+// Reads the next rows straight into 8-bit texels, scaling any maxval, so no more than those rows are held.
+inline auto read_ppm_rows(PpmStream& ppm, const size_t& row_count) -> std::optional<Image> {
+	const auto to_8_bit = [&](const int& value) { return uint8_t(std::clamp(value * 255 / ppm.max_value, 0, 255)); };
+	Image rows{ ppm.width, row_count };
+	rows.texels.resize(ppm.width * row_count);
+	if (ppm.is_binary) {
+		const auto bytes_per_channel = ppm.max_value > 255 ? 2 : 1;
+		std::vector<unsigned char> raw(ppm.width * 3 * bytes_per_channel);
+		const auto get_channel = [&](const size_t& i) { return bytes_per_channel == 2 ? (raw[2 * i] << 8) | raw[2 * i + 1] : int(raw[i]); };
+		for (size_t y = 0; y < row_count; ++y) {
+			ppm.file.read(reinterpret_cast<char*>(raw.data()), raw.size());
+			for (size_t x = 0; x < ppm.width; ++x) {
+				rows.texels[y * ppm.width + x] = RGB8{ to_8_bit(get_channel(3 * x)), to_8_bit(get_channel(3 * x + 1)), to_8_bit(get_channel(3 * x + 2)) };
+			}
+		}
+	}
+	else {
+		for (auto& texel : rows.texels) {
+			int r = 0, g = 0, b = 0;
+			ppm.file >> r >> g >> b;
+			texel = RGB8{ to_8_bit(r), to_8_bit(g), to_8_bit(b) };
+		}
+	}
+	if (!ppm.file) {
+		return {};
+	}
+	return rows;
+}
+
+inline auto tile_count(const size_t& size) {
+	return (size + raytracer::TEXTURE_TILE_SIZE - 1) / raytracer::TEXTURE_TILE_SIZE;
+}
+
+// Where one MIP level starts in a tiled file.
+struct LevelLayout {
+	size_t width;
+	size_t height;
+	uint64_t offset;
+};
+
+// Writes one row of tiles from a band of up to TEXTURE_TILE_SIZE rows, padding by repeating the last row and column.
+inline auto write_tile_row(std::ostream& file, const Image& band) {
+	raytracer::TextureTile tile;
+	for (size_t tile_x = 0; tile_x < tile_count(band.width); ++tile_x) {
+		for (size_t y = 0; y < raytracer::TEXTURE_TILE_SIZE; ++y) {
+			for (size_t x = 0; x < raytracer::TEXTURE_TILE_SIZE; ++x) {
+				const auto source_x = std::min(tile_x * raytracer::TEXTURE_TILE_SIZE + x, band.width - 1);
+				const auto source_y = std::min(y, band.height - 1);
+				tile.texels[y * raytracer::TEXTURE_TILE_SIZE + x] = band.texels[source_y * band.width + source_x];
+			}
+		}
+		file.write(reinterpret_cast<const char*>(&tile), sizeof(tile));
+	}
+}
+
+// Reads back the unpadded rows of one row of tiles of a level that has already been written.
+inline auto read_tile_row(std::istream& file, const LevelLayout& level, const size_t& tile_y) -> Image {
+	const auto first_row = tile_y * raytracer::TEXTURE_TILE_SIZE;
+	Image band{ level.width, std::min(raytracer::TEXTURE_TILE_SIZE, level.height - first_row) };
+	band.texels.resize(band.width * band.height);
+	raytracer::TextureTile tile;
+	file.seekg(std::streamoff(level.offset + tile_y * tile_count(level.width) * TILE_BYTES));
+	for (size_t tile_x = 0; tile_x < tile_count(level.width); ++tile_x) {
+		file.read(reinterpret_cast<char*>(&tile), sizeof(tile));
+		for (size_t y = 0; y < band.height; ++y) {
+			for (size_t x = tile_x * raytracer::TEXTURE_TILE_SIZE; x < std::min((tile_x + 1) * raytracer::TEXTURE_TILE_SIZE, band.width); ++x) {
+				band.texels[y * band.width + x] = tile.texels[y * raytracer::TEXTURE_TILE_SIZE + x % raytracer::TEXTURE_TILE_SIZE];
+			}
+		}
+	}
+	return band;
+}
+
+// Box filters 2x2 blocks of the source rows into one band of the next level, odd sizes reuse the last row or column.
+inline auto downsample(const Image& source, const size_t& first_source_row, const LevelLayout& half, const size_t& first_row) -> Image {
+	Image band{ half.width, std::min(raytracer::TEXTURE_TILE_SIZE, half.height - first_row) };
+	band.texels.reserve(band.width * band.height);
+	for (size_t y = first_row; y < first_row + band.height; ++y) {
+		for (size_t x = 0; x < half.width; ++x) {
+			int r = 0, g = 0, b = 0;
+			for (const auto& [dx, dy] : { std::pair{ 0, 0 }, std::pair{ 1, 0 }, std::pair{ 0, 1 }, std::pair{ 1, 1 } }) {
+				const auto source_y = std::min(2 * y + dy, first_source_row + source.height - 1) - first_source_row;
+				const auto& texel = source.texels[source_y * source.width + std::min(2 * x + dx, source.width - 1)];
+				r += texel.r;
+				g += texel.g;
+				b += texel.b;
+			}
+			band.texels.push_back(RGB8{ uint8_t((r + 2) / 4), uint8_t((g + 2) / 4), uint8_t((b + 2) / 4) });
+		}
+	}
+	return band;
+}
+
+/*
+	The image is streamed a row of tiles at a time and every smaller level is made from the two rows of
+	tiles above it in the file being written, so only a few rows of tiles are ever in memory.
+*/
+auto raytracer::make_tiled_texture(const std::string& image_path, const std::string& tiled_path) -> bool
+{
+	trace::ScopedEvent event{ "texture tiling" };
+	auto ppm = open_ppm(image_path);
+	if (!ppm.has_value()) {
+		return false;
+	}
+	// The streams are closed before a failed file is removed, so nothing is left behind in the cache directory.
+	const auto temp_path = tiled_path + ".tmp";
+	auto is_written = true;
+	{
+		std::ofstream file{ temp_path, std::ios::binary | std::ios::trunc };
+		const auto width = uint32_t(ppm->width);
+		const auto height = uint32_t(ppm->height);
+		file.write(TEXTURE_MAGIC.data(), TEXTURE_MAGIC.size());
+		file.write(reinterpret_cast<const char*>(&TEXTURE_VERSION), sizeof(TEXTURE_VERSION));
+		file.write(reinterpret_cast<const char*>(&width), sizeof(width));
+		file.write(reinterpret_cast<const char*>(&height), sizeof(height));
+
+		auto level = LevelLayout{ ppm->width, ppm->height, HEADER_SIZE };
+		for (size_t tile_y = 0; tile_y < tile_count(level.height) && is_written; ++tile_y) {
+			const auto band = read_ppm_rows(*ppm, std::min(TEXTURE_TILE_SIZE, level.height - tile_y * TEXTURE_TILE_SIZE));
+			is_written = band.has_value();
+			if (is_written) {
+				write_tile_row(file, *band);
+			}
+		}
+
+		std::ifstream written{ temp_path, std::ios::binary };
+		while (is_written && (level.width > 1 || level.height > 1)) {
+			const auto half = LevelLayout{ std::max<size_t>(level.width / 2, 1), std::max<size_t>(level.height / 2, 1),
+				level.offset + tile_count(level.width) * tile_count(level.height) * TILE_BYTES };
+			file.flush();
+			for (size_t tile_y = 0; tile_y < tile_count(half.height); ++tile_y) {
+				auto source = read_tile_row(written, level, 2 * tile_y);
+				if (2 * tile_y + 1 < tile_count(level.height)) {
+					const auto lower = read_tile_row(written, level, 2 * tile_y + 1);
+					source.texels.insert(source.texels.end(), lower.texels.begin(), lower.texels.end());
+					source.height += lower.height;
+				}
+				write_tile_row(file, downsample(source, 2 * tile_y * TEXTURE_TILE_SIZE, half, tile_y * TEXTURE_TILE_SIZE));
+			}
+			level = half;
+		}
+		is_written &= file.good() && written.good();
+	}
+	if (!is_written || std::rename(temp_path.c_str(), tiled_path.c_str()) != 0) [[unlikely]] {
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+inline auto next_cache_id() {
+	static std::atomic<uint64_t> next_id = 1;
+	return next_id++;
+}
+
+inline auto get_cache_directory(const std::string& cache_directory) -> std::filesystem::path {
+	if (!cache_directory.empty()) {
+		return cache_directory;
+	}
+	std::error_code error;
+	return std::filesystem::temp_directory_path(error) / "raytracer_textures";
+}
+
+raytracer::TextureCache::TextureCache(const size_t& max_resident_bytes, const std::string& cache_directory)
+	: id_(next_cache_id()), max_shard_bytes_(std::max(max_resident_bytes / SHARD_COUNT, TILE_BYTES)),
+	cache_directory_(get_cache_directory(cache_directory))
+{}
+
+auto raytracer::TextureCache::get_tiled_path(const std::string& image_path) const -> std::string
+{
+	std::error_code error;
+	const auto absolute_path = std::filesystem::absolute(image_path, error).lexically_normal();
+	std::ostringstream name;
+	name << std::filesystem::path(image_path).filename().string() << "." << std::hex << std::hash<std::string>{}(absolute_path.string()) << ".tiled";
+	return (cache_directory_ / name.str()).string();
+}
+
+auto raytracer::TextureCache::add(const std::string& image_path) -> std::optional<uint32_t>
+{
+	const auto tiled_path = get_tiled_path(image_path);
+	std::error_code error;
+	std::filesystem::create_directories(cache_directory_, error);
+	const auto is_stale = !std::filesystem::exists(tiled_path, error)
+		|| std::filesystem::last_write_time(tiled_path, error) < std::filesystem::last_write_time(image_path, error);
+	if (is_stale && !make_tiled_texture(image_path, tiled_path)) {
+		std::cout << "TEXTURE ERROR:\tCould not convert " << image_path << " to " << tiled_path << "\n";
+		return {};
+	}
+
+	auto texture = std::make_unique<TextureFile>();
+	texture->file.open(tiled_path, std::ios::binary);
+	std::array<char, 4> magic{};
+	uint32_t version = 0, width = 0, height = 0;
+	texture->file.read(magic.data(), magic.size());
+	texture->file.read(reinterpret_cast<char*>(&version), sizeof(version));
+	texture->file.read(reinterpret_cast<char*>(&width), sizeof(width));
+	texture->file.read(reinterpret_cast<char*>(&height), sizeof(height));
+	if (!texture->file.good() || magic != TEXTURE_MAGIC || version != TEXTURE_VERSION || width == 0 || height == 0) {
+		std::cout << "TEXTURE ERROR:\t" << tiled_path << " is not a tiled texture\n";
+		return {};
+	}
+
+	uint64_t offset = HEADER_SIZE;
+	size_t level_width = width, level_height = height;
+	while (true) {
+		const auto level = Level{ level_width, level_height, tile_count(level_width), tile_count(level_height), offset };
+		texture->levels.push_back(level);
+		offset += level.tiles_x * level.tiles_y * TILE_BYTES;
+		if (level_width == 1 && level_height == 1) {
+			break;
+		}
+		level_width = std::max<size_t>(level_width / 2, 1);
+		level_height = std::max<size_t>(level_height / 2, 1);
+	}
+	textures_.push_back(std::move(texture));
+	return uint32_t(textures_.size() - 1);
+}
+
+auto raytracer::TextureCache::load_tile(const uint32_t& texture, const size_t& level, const size_t& tile_index) -> std::shared_ptr<const TextureTile>
+{
+	auto tile = std::make_shared<TextureTile>();
+	auto& file = *textures_[texture];
+	std::lock_guard lock{ file.file_mutex };
+	file.file.clear();
+	file.file.seekg(std::streamoff(file.levels[level].offset + tile_index * TILE_BYTES));
+	file.file.read(reinterpret_cast<char*>(tile.get()), TILE_BYTES);
+	if (!file.file.good()) [[unlikely]] {
+		tile->texels.fill(RGB8{ 255, 0, 255 });
+	}
+	return tile;
+}
+
+/*
+	Lookups are counted per thread so sampling never writes to a cache line shared with other threads.
+	Each thread remembers the count of the cache it used last, and cache ids are never reused.
+*/
+auto raytracer::TextureCache::get_lookup_count() -> LookupCount&
+{
+	struct RecentCount {
+		uint64_t cache_id = 0;
+		LookupCount* count = nullptr;
+	};
+	thread_local RecentCount recent;
+	if (recent.cache_id == id_) [[likely]] {
+		return *recent.count;
+	}
+	std::lock_guard lock{ lookup_counts_mutex_ };
+	auto& count = lookup_counts_[std::this_thread::get_id()];
+	if (!count) {
+		count = std::make_unique<LookupCount>();
+	}
+	recent = RecentCount{ id_, count.get() };
+	return *count;
+}
+
+/*
+	Each thread keeps a small direct mapped table of the tiles it used last. The shared pointers keep
+	those tiles alive after eviction, so resident memory can exceed the budget by a few tiles per thread.
+*/
+auto raytracer::TextureCache::get_tile(const uint32_t& texture, const size_t& level, const size_t& tile_index) -> std::shared_ptr<const TextureTile>
+{
+	struct RecentTile {
+		uint64_t cache_id = 0;
+		uint64_t key = 0;
+		std::shared_ptr<const TextureTile> tile;
+	};
+	thread_local std::array<RecentTile, 16> recent_tiles;
+
+	const auto key = (uint64_t(texture) << 48) | (uint64_t(level) << 40) | uint64_t(tile_index);
+	const auto hash = key * 0x9e3779b97f4a7c15;
+	auto& recent = recent_tiles[hash >> 60];
+	if (recent.cache_id == id_ && recent.key == key) [[likely]] {
+		return recent.tile;
+	}
+
+	auto& shard = shards_[(hash >> 32) % SHARD_COUNT];
+	std::shared_ptr<const TextureTile> tile;
+	{
+		std::lock_guard lock{ shard.mutex };
+		if (auto found = shard.tiles.find(key); found != shard.tiles.end()) {
+			shard.recency.splice(shard.recency.begin(), shard.recency, found->second.second);
+			tile = found->second.first;
+		}
+	}
+	if (!tile) {
+		tile = load_tile(texture, level, tile_index);
+		tile_loads_++;
+
+		std::lock_guard lock{ shard.mutex };
+		if (auto found = shard.tiles.find(key); found != shard.tiles.end()) {
+			tile = found->second.first;
+		}
+		else {
+			shard.recency.push_front(key);
+			shard.tiles.emplace(key, std::pair{ tile, shard.recency.begin() });
+			shard.resident_bytes += TILE_BYTES;
+			while (shard.resident_bytes > max_shard_bytes_ && shard.recency.size() > 1) {
+				shard.tiles.erase(shard.recency.back());
+				shard.recency.pop_back();
+				shard.resident_bytes -= TILE_BYTES;
+				evictions_++;
+			}
+		}
+	}
+	recent = RecentTile{ id_, key, tile };
+	return tile;
+}
+
+auto raytracer::TextureCache::get_texel(const uint32_t& texture, const size_t& level, const size_t& x, const size_t& y) -> RGB8
+{
+	const auto& level_info = textures_[texture]->levels[level];
+	const auto tile_index = (y / TEXTURE_TILE_SIZE) * level_info.tiles_x + x / TEXTURE_TILE_SIZE;
+	return get_tile(texture, level, tile_index)->texels[(y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE];
+}
+
+auto raytracer::TextureCache::sample_level(const uint32_t& texture, const size_t& level, const float& u, const float& v) -> RGBf
+{
+	const auto& level_info = textures_[texture]->levels[level];
+	const auto width = int64_t(level_info.width);
+	const auto height = int64_t(level_info.height);
+	const auto x = (u - std::floor(u)) * width - 0.5f;
+	const auto y = std::clamp(v, 0.0f, 1.0f) * height - 0.5f;
+	const auto x0 = int64_t(std::floor(x));
+	const auto y0 = int64_t(std::floor(y));
+	const auto fx = x - x0;
+	const auto fy = y - y0;
+
+	RGBf colour{ 0,0,0 };
+	for (const auto& [dx, dy, weight] : {
+		std::tuple{ 0, 0, (1 - fx) * (1 - fy) }, std::tuple{ 1, 0, fx * (1 - fy) },
+		std::tuple{ 0, 1, (1 - fx) * fy }, std::tuple{ 1, 1, fx * fy } }) {
+		const auto texel_x = size_t(((x0 + dx) % width + width) % width);
+		const auto texel_y = size_t(std::clamp<int64_t>(y0 + dy, 0, height - 1));
+		const auto texel = get_texel(texture, level, texel_x, texel_y);
+		colour.r += weight * texel.r;
+		colour.g += weight * texel.g;
+		colour.b += weight * texel.b;
+	}
+	return colour;
+}
+
+auto raytracer::TextureCache::sample(const uint32_t& texture, const float& u, const float& v, const float& lod) -> RGBf
+{
+	auto& count = get_lookup_count();
+	count.lookups.store(count.lookups.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	const auto max_level = float(textures_[texture]->levels.size() - 1);
+	const auto level = std::clamp(lod, 0.0f, max_level);
+	const auto lower = size_t(level);
+	const auto blend = level - lower;
+
+	const auto colour = sample_level(texture, lower, u, v);
+	if (blend <= 0) {
+		return colour;
+	}
+	const auto upper = sample_level(texture, lower + 1, u, v);
+	return RGBf{
+		colour.r + blend * (upper.r - colour.r),
+		colour.g + blend * (upper.g - colour.g),
+		colour.b + blend * (upper.b - colour.b)
+	};
+}
+
+auto raytracer::TextureCache::get_width(const uint32_t& texture) const -> size_t
+{
+	return textures_[texture]->levels.front().width;
+}
+
+auto raytracer::TextureCache::get_stats() const -> Stats
+{
+	uint64_t lookups = 0;
+	{
+		std::lock_guard lock{ lookup_counts_mutex_ };
+		for (const auto& [thread, count] : lookup_counts_) {
+			lookups += count->lookups.load(std::memory_order_relaxed);
+		}
+	}
+	return Stats{ lookups, tile_loads_.load(), evictions_.load() };
+}
+
+auto raytracer::TextureCache::get_resident_bytes() const -> size_t
+{
+	size_t bytes = 0;
+	for (auto& shard : shards_) {
+		std::lock_guard lock{ const_cast<Shard&>(shard).mutex };
+		bytes += shard.resident_bytes;
+	}
+	return bytes;
+}
@@ -0,0 +1,207 @@
+#include <cmath>
+#include <cstdint>
+#include <bit>
+#include <array>
+#include <vector>
+#include <span>
+#include <type_traits>
+#include <thread>
+#include <algorithm>
+
+#include "tonemap.h"
+#include "trace.h"
+
+constexpr float SRGB_LINEAR_END = 0.0031308f;
+constexpr size_t DITHER_TILE_SIZE = 64;
+
+// log2 of x > 0 to about 1e-4, from the exponent bits and a quartic for the mantissa.
+inline auto fast_log2(const float& x) -> float {
+	const auto bits = std::bit_cast<int32_t>(x);
+	const auto exponent = float((bits >> 23) - 127);
+	const auto t = std::bit_cast<float>((bits & 0x7fffff) | 0x3f800000) - 1;
+	return exponent + t * (1.4386380f + t * (-0.6777433f + t * (0.3218797f + t * -0.0828607f)));
+}
+// 2^x for x above -126, split into a whole power set in the exponent bits and a quartic for the rest.
+inline auto fast_exp2(const float& x) -> float {
+	const auto truncated = int32_t(x);
+	const auto whole = truncated - int32_t(x < float(truncated));
+	const auto fraction = x - float(whole);
+	const auto mantissa = 1 + fraction * (0.6930175f + fraction * (0.2414487f + fraction * (0.0519480f + fraction * 0.0135817f)));
+	return std::bit_cast<float>((whole + 127) << 23) * mantissa;
+}
+
+/*
+	The power curve lies under the line of the linear segment past where they meet, so the smaller
+	of the two picks the right piece without a branch. The curve's input is raised to the meeting
+	point by comparing bits as integers (ordered like the floats for x >= 0), as with a float
+	compare, or a select between the pieces, the loop does not vectorise.
+*/
+inline auto encode_srgb(const float& linear) -> float {
+	constexpr auto LINEAR_END_BITS = std::bit_cast<int32_t>(SRGB_LINEAR_END);
+	const auto raised = std::bit_cast<float>(std::max(std::bit_cast<int32_t>(linear), LINEAR_END_BITS));
+	return std::min(linear * 12.92f, 1.055f * fast_exp2(fast_log2(raised) * (1 / 2.4f)) - 0.055f);
+}
+inline auto reinhard(const float& x) -> float {
+	return x / (1 + x);
+}
+inline auto aces(const float& x) -> float {
+	return (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+}
+
+// Triangular noise in -1 to 1, the sum of the two 16-bit halves of a hash of the position.
+inline auto get_dither(const uint32_t& x, const uint32_t& y) -> float {
+	auto hash = (x * 0x9e3779b1u) ^ (y * 0x85ebca77u);
+	hash = (hash ^ (hash >> 15)) * 0x2c1b3c6du;
+	hash ^= hash >> 12;
+	return float(int32_t(hash & 0xffff) + int32_t(hash >> 16)) * (1 / 65536.0f) - 1;
+}
+
+// The noise repeats every DITHER_TILE_SIZE pixels, which is not visible and makes each row a few copies.
+inline auto get_dither_tile() -> const std::array<float, DITHER_TILE_SIZE * DITHER_TILE_SIZE>& {
+	static const auto tile = []() {
+		std::array<float, DITHER_TILE_SIZE * DITHER_TILE_SIZE> noise;
+		for (uint32_t y = 0; y < DITHER_TILE_SIZE; ++y) {
+			for (uint32_t x = 0; x < DITHER_TILE_SIZE; ++x) {
+				noise[y * DITHER_TILE_SIZE + x] = get_dither(x, y);
+			}
+		}
+		return noise;
+	}();
+	return tile;
+}
+inline auto fill_dither_row(std::vector<float>& noise, const size_t& y) {
+	const auto* tile_row = get_dither_tile().data() + (y % DITHER_TILE_SIZE) * DITHER_TILE_SIZE;
+	for (size_t x = 0; x < noise.size(); x += DITHER_TILE_SIZE) {
+		std::copy_n(tile_row, std::min(DITHER_TILE_SIZE, noise.size() - x), noise.begin() + x);
+	}
+}
+
+inline auto quantise(const float& value, const float& noise) -> uint8_t {
+	return uint8_t(int32_t(std::clamp(value * 255 + noise + 0.5f, 0.0f, 255.0f)));
+}
+
+inline auto for_each_row_band(const size_t& height, const auto& process_rows) {
+	const auto thread_count = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, height);
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < thread_count; ++i) {
+		threads.emplace_back(process_rows, height * i / thread_count, height * (i + 1) / thread_count);
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+inline auto apply_to_plane(std::span<float> plane, const auto& function) {
+	for (auto& value : plane) {
+		value = function(value);
+	}
+}
+
+// Every step before rounding, on one plane of exposed colour.
+inline auto apply_curves(std::span<float> plane, const raytracer::TonemapSettings& settings) {
+	if (settings.curve == raytracer::ToneCurve::reinhard) {
+		apply_to_plane(plane, reinhard);
+	}
+	else if (settings.curve == raytracer::ToneCurve::aces) {
+		apply_to_plane(plane, aces);
+	}
+	if (settings.is_srgb) {
+		apply_to_plane(plane, encode_srgb);
+	}
+}
+
+template<typename Pixel>
+constexpr bool IS_8_BIT = std::is_same_v<Pixel, RGB8> || std::is_same_v<Pixel, RGBA8>;
+
+template<typename Pixel>
+auto raytracer::tonemap(const ImageView<Pixel>& image, std::span<RGB8> tonemapped, const TonemapSettings& settings) -> void
+{
+	trace::ScopedEvent event{ "tonemap" };
+	if (image.width == 0 || image.height == 0 || tonemapped.size() < image.width * image.height) [[unlikely]] {
+		return;
+	}
+	const auto scale = std::exp2(settings.exposure);
+
+	/*
+		An 8-bit channel has only 256 values, so they are run through the curves once and each
+		pixel becomes table lookups. The table is built by the same code as the float path.
+	*/
+	std::array<float, 256> curve_table;
+	std::array<uint8_t, 256> byte_table;
+	if constexpr (IS_8_BIT<Pixel>) {
+		for (size_t i = 0; i < curve_table.size(); ++i) {
+			curve_table[i] = std::max(i / 255.0f * scale, 0.0f);
+		}
+		apply_curves(curve_table, settings);
+		for (size_t i = 0; i < byte_table.size(); ++i) {
+			byte_table[i] = quantise(curve_table[i], 0);
+		}
+	}
+
+	// Otherwise each step runs over a whole row of one plane before the next step starts.
+	for_each_row_band(image.height, [&](const size_t& row_begin, const size_t& row_end) {
+		// A local copy, stores through the uint8_t rows could alias image.width and hide the trip count.
+		const auto width = image.width;
+		std::array<std::vector<float>, 3> planes;
+		std::array<std::vector<uint8_t>, 3> bytes;
+		for (size_t c = 0; c < 3; ++c) {
+			planes[c].resize(IS_8_BIT<Pixel> ? 0 : width);
+			bytes[c].resize(IS_8_BIT<Pixel> ? 0 : width);
+		}
+		std::vector<float> noise(width, 0.0f);
+		for (size_t y = row_begin; y < row_end; ++y) {
+			const auto row = image.row(y);
+			auto* out = tonemapped.data() + y * width;
+			if (settings.is_dithered) {
+				fill_dither_row(noise, y);
+			}
+			if constexpr (IS_8_BIT<Pixel>) {
+				if (!settings.is_dithered) {
+					for (size_t x = 0; x < width; ++x) {
+						out[x] = RGB8{ byte_table[row[x].r], byte_table[row[x].g], byte_table[row[x].b] };
+					}
+					continue;
+				}
+				for (size_t x = 0; x < width; ++x) {
+					out[x] = RGB8{
+						quantise(curve_table[row[x].r], noise[x]),
+						quantise(curve_table[row[x].g], noise[x]),
+						quantise(curve_table[row[x].b], noise[x])
+					};
+				}
+				continue;
+			}
+
+			auto& r = planes[0];
+			auto& g = planes[1];
+			auto& b = planes[2];
+			for (size_t x = 0; x < width; ++x) {
+				const auto colour = PixelTraits<Pixel>::decode(row[x]);
+				r[x] = std::max(colour.r * scale, 0.0f);
+				g[x] = std::max(colour.g * scale, 0.0f);
+				b[x] = std::max(colour.b * scale, 0.0f);
+			}
+			for (auto& plane : planes) {
+				apply_curves(plane, settings);
+			}
+			for (size_t c = 0; c < 3; ++c) {
+				for (size_t x = 0; x < width; ++x) {
+					bytes[c][x] = quantise(planes[c][x], noise[x]);
+				}
+			}
+			for (size_t x = 0; x < width; ++x) {
+				out[x] = RGB8{ bytes[0][x], bytes[1][x], bytes[2][x] };
+			}
+		}
+	});
+}
+
+#define RT_INSTANTIATE_TONEMAP(Pixel) \
+	template auto raytracer::tonemap(const ImageView<Pixel>& image, std::span<RGB8> tonemapped, const TonemapSettings& settings) -> void;
+
+RT_INSTANTIATE_TONEMAP(RGB)
+RT_INSTANTIATE_TONEMAP(RGB8)
+RT_INSTANTIATE_TONEMAP(RGBA8)
+RT_INSTANTIATE_TONEMAP(RGB16)
+RT_INSTANTIATE_TONEMAP(RGBh)
+RT_INSTANTIATE_TONEMAP(RGBf)
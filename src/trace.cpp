@@ -0,0 +1,105 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <array>
+#include <iomanip>
+
+#include "trace.h"
+
+// File-local so the names cannot collide with the symbols of programs that link the library.
+namespace {
+
+struct TraceEvent {
+	const char* name;
+	uint64_t begin_ns;
+	uint64_t end_ns;
+	int64_t arg;
+};
+
+struct RingBuffer {
+	size_t thread_id;
+	std::atomic<uint64_t> count{ 0 };
+	std::array<TraceEvent, trace::RING_CAPACITY> events;
+};
+
+// Buffers are never freed while the process runs, so a dump can read them after their threads exit.
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<RingBuffer>> ring_buffers;
+std::vector<RingBuffer*> free_ring_buffers;
+const auto trace_epoch = std::chrono::steady_clock::now();
+
+struct ThreadRingBuffer {
+	RingBuffer* buffer = nullptr;
+
+	auto get() -> RingBuffer& {
+		if (buffer == nullptr) [[unlikely]] {
+			std::lock_guard lock{ registry_mutex };
+			if (!free_ring_buffers.empty()) {
+				buffer = free_ring_buffers.back();
+				free_ring_buffers.pop_back();
+			}
+			else {
+				ring_buffers.push_back(std::make_unique<RingBuffer>());
+				buffer = ring_buffers.back().get();
+				buffer->thread_id = ring_buffers.size();
+			}
+		}
+		return *buffer;
+	}
+	~ThreadRingBuffer() {
+		if (buffer != nullptr) {
+			std::lock_guard lock{ registry_mutex };
+			free_ring_buffers.push_back(buffer);
+		}
+	}
+};
+thread_local ThreadRingBuffer thread_ring_buffer;
+
+}
+
+auto trace::now_ns() -> uint64_t
+{
+	// Offset by one so a timestamp of zero can mean "not recording".
+	return 1 + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_epoch).count();
+}
+
+auto trace::start() -> void
+{
+	is_enabled.store(true, std::memory_order_relaxed);
+}
+
+auto trace::record(const char* name, const uint64_t& begin_ns, const uint64_t& end_ns, const int64_t& arg) -> void
+{
+	auto& buffer = thread_ring_buffer.get();
+	const auto index = buffer.count.load(std::memory_order_relaxed);
+	buffer.events[index % RING_CAPACITY] = TraceEvent{ name, begin_ns, end_ns, arg };
+	buffer.count.store(index + 1, std::memory_order_release);
+}
+
+auto trace::write_chrome_json(const std::string& path) -> bool
+{
+	std::ofstream file{ path };
+	std::lock_guard lock{ registry_mutex };
+	auto is_first = true;
+
+	file << "{\"traceEvents\":[\n" << std::fixed << std::setprecision(3);
+	for (const auto& buffer : ring_buffers) {
+		const auto count = buffer->count.load(std::memory_order_acquire);
+		const auto first = count > RING_CAPACITY ? count - RING_CAPACITY : 0;
+		for (auto i = first; i < count; ++i) {
+			const auto& event = buffer->events[i % RING_CAPACITY];
+			file << (is_first ? "" : ",\n")
+				<< "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->thread_id
+				<< ",\"ts\":" << event.begin_ns / 1e3 << ",\"dur\":" << (event.end_ns - event.begin_ns) / 1e3;
+			if (event.arg >= 0) {
+				file << ",\"args\":{\"index\":" << event.arg << "}";
+			}
+			file << "}";
+			is_first = false;
+		}
+	}
+	file << "\n],\"displayTimeUnit\":\"ms\"}\n";
+	return file.good();
+}
@@ -0,0 +1,804 @@
+#include "linearAlgebra.h"
+#include "shapes.h"
+#include "raytracer.h"
+#include "scenes.h"
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <optional>
+#include <algorithm>
+#include <span>
+#include <type_traits>
+#include <filesystem>
+#include <memory>
+#include <limits>
+#include <array>
+#include <iterator>
+#include <thread>
+#include <chrono>
+#include <mutex>
+
+#include "texture.h"
+#include "exr.h"
+#include "tonemap.h"
+#include "checkpoint.h"
+#include "output_pipeline.h"
+#ifdef RAYTRACER_DISTRIBUTED
+#include "distributed.h"
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+/*
+	Renders every reference scene, plus a progressive render, one resumed from a checkpoint, material sorted renders, distributed renders, a textured
+	scene, a denoised render, a render with every AOV, tonemapped output and the default scene in each compact
+	framebuffer format, at a small fixed size and compares the result with the golden image stored in GOLDEN_DIR. Sampling is seeded per pixel, so on the
+	platform the goldens came from the images match exactly. --exact requires that, otherwise the
+	images only need to pass the PSNR and SSIM thresholds. --update rewrites the goldens.
+*/
+constexpr int GOLDEN_SIZE = 128;
+constexpr double MIN_PSNR = 35.0;
+constexpr double MIN_SSIM = 0.95;
+
+struct Image {
+	int width;
+	int height;
+	std::vector<RGB> pixels;
+};
+
+auto read_ppm(const std::string& path) -> std::optional<Image> {
+	std::ifstream file{ path };
+	std::string magic;
+	int max_value;
+	Image image;
+	file >> magic >> image.width >> image.height >> max_value;
+	if (!file.good() || magic != "P3") {
+		return {};
+	}
+	image.pixels.resize(image.width * image.height);
+	for (auto& rgb : image.pixels) {
+		file >> rgb.r >> rgb.g >> rgb.b;
+	}
+	if (file.fail()) {
+		return {};
+	}
+	return image;
+}
+
+auto psnr(const Image& a, const Image& b) -> double {
+	double squared_error = 0;
+	for (size_t i = 0; i < a.pixels.size(); ++i) {
+		squared_error += std::pow(a.pixels[i].r - b.pixels[i].r, 2);
+		squared_error += std::pow(a.pixels[i].g - b.pixels[i].g, 2);
+		squared_error += std::pow(a.pixels[i].b - b.pixels[i].b, 2);
+	}
+	const auto mse = squared_error / (3.0 * a.pixels.size());
+	return mse == 0 ? INFINITY : 10 * std::log10(255.0 * 255.0 / mse);
+}
+
+// Mean SSIM of luminance over 8x8 windows moved in steps of 4 pixels.
+auto ssim(const Image& a, const Image& b) -> double {
+	constexpr int WINDOW = 8;
+	constexpr int STEP = 4;
+	constexpr double C1 = (0.01 * 255) * (0.01 * 255);
+	constexpr double C2 = (0.03 * 255) * (0.03 * 255);
+	const auto luminance = [](const RGB& rgb) { return 0.2126 * rgb.r + 0.7152 * rgb.g + 0.0722 * rgb.b; };
+
+	double ssim_sum = 0;
+	size_t window_count = 0;
+	for (int y = 0; y + WINDOW <= a.height; y += STEP) {
+		for (int x = 0; x + WINDOW <= a.width; x += STEP) {
+			double sum_a = 0, sum_b = 0, sum_aa = 0, sum_bb = 0, sum_ab = 0;
+			for (int wy = y; wy < y + WINDOW; ++wy) {
+				for (int wx = x; wx < x + WINDOW; ++wx) {
+					const auto la = luminance(a.pixels[wy * a.width + wx]);
+					const auto lb = luminance(b.pixels[wy * b.width + wx]);
+					sum_a += la; sum_b += lb;
+					sum_aa += la * la; sum_bb += lb * lb; sum_ab += la * lb;
+				}
+			}
+			constexpr double N = WINDOW * WINDOW;
+			const auto mean_a = sum_a / N, mean_b = sum_b / N;
+			const auto var_a = sum_aa / N - mean_a * mean_a;
+			const auto var_b = sum_bb / N - mean_b * mean_b;
+			const auto covariance = sum_ab / N - mean_a * mean_b;
+			ssim_sum += ((2 * mean_a * mean_b + C1) * (2 * covariance + C2))
+				/ ((mean_a * mean_a + mean_b * mean_b + C1) * (var_a + var_b + C2));
+			window_count++;
+		}
+	}
+	return ssim_sum / window_count;
+}
+
+// A 256x128 checkerboard of 16 texel squares, with a colour gradient so MIP levels differ.
+auto write_checker_texture(const std::string& path) {
+	std::ofstream file{ path };
+	file << "P3\n256 128\n255\n";
+	for (int y = 0; y < 128; ++y) {
+		for (int x = 0; x < 256; ++x) {
+			const auto is_light = ((x / 16) + (y / 16)) % 2 == 0;
+			file << (is_light ? 230 : 40) << " " << (is_light ? 230 - y : 40 + y) << " " << x / 2 << " ";
+		}
+	}
+}
+
+// Reads bits least significant first, as deflate packs them. Reading past the end gives zeros and sets is_overrun.
+struct BitReader {
+	std::span<const uint8_t> data;
+	size_t position = 0;
+	uint32_t buffer = 0;
+	int count = 0;
+	bool is_overrun = false;
+
+	auto bits(const int& n) -> uint32_t {
+		while (count < n) {
+			is_overrun |= position >= data.size();
+			buffer |= uint32_t(position < data.size() ? data[position++] : 0) << count;
+			count += 8;
+		}
+		const auto value = buffer & ((1u << n) - 1);
+		buffer >>= n;
+		count -= n;
+		return value;
+	}
+};
+
+// Canonical Huffman codes as a count of codes per length and the symbols in code order.
+struct Huffman {
+	std::array<uint16_t, 16> counts{};
+	std::vector<uint16_t> symbols;
+};
+
+auto make_huffman(std::span<const uint8_t> lengths) -> Huffman {
+	Huffman huffman;
+	for (const auto& length : lengths) {
+		huffman.counts[length]++;
+	}
+	huffman.counts[0] = 0;
+	for (size_t length = 1; length < huffman.counts.size(); ++length) {
+		for (size_t symbol = 0; symbol < lengths.size(); ++symbol) {
+			if (lengths[symbol] == length) {
+				huffman.symbols.push_back(uint16_t(symbol));
+			}
+		}
+	}
+	return huffman;
+}
+
+auto decode_symbol(BitReader& reader, const Huffman& huffman) -> int {
+	int code = 0, first = 0, index = 0;
+	for (size_t length = 1; length < huffman.counts.size(); ++length) {
+		code |= int(reader.bits(1));
+		if (code - first < huffman.counts[length]) {
+			return huffman.symbols[index + code - first];
+		}
+		index += huffman.counts[length];
+		first = (first + huffman.counts[length]) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+// A small inflate, independent of the encoder, for reading back zlib streams. Empty when the stream or its checksum is bad.
+auto inflate_zlib(std::span<const uint8_t> stream) -> std::optional<std::vector<uint8_t>> {
+	constexpr std::array<uint16_t, 29> LENGTH_BASE = { 3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258 };
+	constexpr std::array<uint8_t, 29> LENGTH_EXTRA = { 0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0 };
+	constexpr std::array<uint16_t, 30> DISTANCE_BASE = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577 };
+	constexpr std::array<uint8_t, 30> DISTANCE_EXTRA = { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13 };
+	constexpr std::array<uint8_t, 19> CODE_LENGTH_ORDER = { 16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15 };
+	if (stream.size() < 6 || (stream[0] & 0x0f) != 8 || (stream[0] * 256 + stream[1]) % 31 != 0) {
+		return {};
+	}
+	std::vector<uint8_t> out;
+	BitReader reader{ stream.subspan(2, stream.size() - 6) };
+	for (auto is_final = false; !is_final && !reader.is_overrun;) {
+		is_final = reader.bits(1) == 1;
+		const auto type = reader.bits(2);
+		if (type == 0) {
+			reader.buffer = 0;
+			reader.count = 0;
+			const auto length = reader.bits(16);
+			if ((reader.bits(16) ^ 0xffff) != length) {
+				return {};
+			}
+			for (size_t i = 0; i < length; ++i) {
+				out.push_back(uint8_t(reader.bits(8)));
+			}
+			continue;
+		}
+		std::vector<uint8_t> lengths;
+		size_t literal_count = 288;
+		if (type == 1) {
+			lengths.assign(288, 8);
+			std::fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+			std::fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+			lengths.insert(lengths.end(), 30, 5);
+		}
+		else if (type == 2) {
+			literal_count = reader.bits(5) + 257;
+			const auto distance_count = reader.bits(5) + 1;
+			const auto code_length_count = reader.bits(4) + 4;
+			std::array<uint8_t, 19> code_length_lengths{};
+			for (size_t i = 0; i < code_length_count; ++i) {
+				code_length_lengths[CODE_LENGTH_ORDER[i]] = uint8_t(reader.bits(3));
+			}
+			const auto code_lengths = make_huffman(code_length_lengths);
+			while (lengths.size() < literal_count + distance_count && !reader.is_overrun) {
+				const auto symbol = decode_symbol(reader, code_lengths);
+				if (symbol < 0 || (symbol == 16 && lengths.empty())) {
+					return {};
+				}
+				if (symbol < 16) {
+					lengths.push_back(uint8_t(symbol));
+				}
+				else if (symbol == 16) {
+					lengths.insert(lengths.end(), 3 + reader.bits(2), lengths.back());
+				}
+				else {
+					lengths.insert(lengths.end(), symbol == 17 ? 3 + reader.bits(3) : 11 + reader.bits(7), 0);
+				}
+			}
+			if (lengths.size() != literal_count + distance_count) {
+				return {};
+			}
+		}
+		else {
+			return {};
+		}
+		const auto literals = make_huffman(std::span(lengths).first(literal_count));
+		const auto distances = make_huffman(std::span(lengths).subspan(literal_count));
+		while (!reader.is_overrun) {
+			const auto symbol = decode_symbol(reader, literals);
+			if (symbol < 0 || symbol > 285) {
+				return {};
+			}
+			if (symbol < 256) {
+				out.push_back(uint8_t(symbol));
+				continue;
+			}
+			if (symbol == 256) {
+				break;
+			}
+			const auto length = LENGTH_BASE[symbol - 257] + reader.bits(LENGTH_EXTRA[symbol - 257]);
+			const auto distance_symbol = decode_symbol(reader, distances);
+			if (distance_symbol < 0 || distance_symbol > 29) {
+				return {};
+			}
+			const auto distance = DISTANCE_BASE[distance_symbol] + reader.bits(DISTANCE_EXTRA[distance_symbol]);
+			if (distance > out.size()) {
+				return {};
+			}
+			for (size_t i = 0; i < length; ++i) {
+				out.push_back(out[out.size() - distance]);
+			}
+		}
+	}
+	uint32_t a = 1, b = 0;
+	for (const auto& byte : out) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	const auto checksum = stream.last(4);
+	const auto expected = (uint32_t(checksum[0]) << 24) | (uint32_t(checksum[1]) << 16) | (uint32_t(checksum[2]) << 8) | checksum[3];
+	if (reader.is_overrun || ((b << 16) | a) != expected) {
+		return {};
+	}
+	return out;
+}
+
+// Undoes the EXR RLE, a negative count of bytes as they are or a count less one of a repeated byte.
+auto run_length_decode(std::span<const uint8_t> in) -> std::vector<uint8_t> {
+	std::vector<uint8_t> out;
+	for (size_t i = 0; i < in.size();) {
+		const auto count = int8_t(in[i++]);
+		if (count < 0) {
+			out.insert(out.end(), in.begin() + i, in.begin() + std::min(in.size(), i - count));
+			i -= count;
+		}
+		else if (i < in.size()) {
+			out.insert(out.end(), count + 1, in[i++]);
+		}
+	}
+	return out;
+}
+
+/*
+	Reads every scanline block of an EXR written by write_exr back into the bytes it was made from,
+	undoing the RLE or ZIP compression and the byte predictor. Empty when a block can't be decoded.
+*/
+auto read_exr_scanlines(const std::string& path, const size_t& width, const size_t& height, const size_t& channel_count,
+	const raytracer::ExrCompression& compression) -> std::optional<std::vector<uint8_t>> {
+	std::ifstream file{ path, std::ios::binary };
+	const std::vector<uint8_t> bytes{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+	const auto read_int = [&](const size_t& at, const size_t& size) {
+		uint64_t value = 0;
+		for (size_t i = 0; i < size; ++i) {
+			value |= uint64_t(bytes[at + i]) << (8 * i);
+		}
+		return value;
+	};
+	size_t position = 8;
+	while (position < bytes.size() && bytes[position] != 0) {
+		position = std::find(bytes.begin() + position, bytes.end(), 0) - bytes.begin() + 1;
+		position = std::find(bytes.begin() + position, bytes.end(), 0) - bytes.begin() + 1;
+		position += 4 + read_int(position, 4);
+	}
+	position++;
+
+	const auto lines_per_block = compression == raytracer::ExrCompression::zip ? size_t(16) : size_t(1);
+	const auto block_count = (height + lines_per_block - 1) / lines_per_block;
+	std::vector<uint8_t> scanlines;
+	for (size_t i = 0; i < block_count; ++i) {
+		const auto offset = read_int(position + i * sizeof(uint64_t), sizeof(uint64_t));
+		const auto lines = std::min(lines_per_block, height - i * lines_per_block);
+		const auto raw_size = lines * channel_count * width * sizeof(float);
+		if (offset + 8 > bytes.size() || read_int(offset, 4) != i * lines_per_block) {
+			return {};
+		}
+		const auto block = std::span(bytes).subspan(offset + 8, std::min<size_t>(read_int(offset + 4, 4), bytes.size() - offset - 8));
+		if (block.size() == raw_size) {
+			scanlines.insert(scanlines.end(), block.begin(), block.end());
+			continue;
+		}
+		std::vector<uint8_t> predicted;
+		if (compression == raytracer::ExrCompression::rle) {
+			predicted = run_length_decode(block);
+		}
+		else if (auto inflated = inflate_zlib(block)) {
+			predicted = std::move(*inflated);
+		}
+		if (predicted.size() != raw_size) {
+			return {};
+		}
+		for (size_t j = 1; j < predicted.size(); ++j) {
+			predicted[j] = uint8_t(predicted[j - 1] + predicted[j] - 128);
+		}
+		const auto half = (predicted.size() + 1) / 2;
+		for (size_t j = 0; j < predicted.size(); ++j) {
+			scanlines.push_back(predicted[(j % 2 == 0) ? j / 2 : half + j / 2]);
+		}
+	}
+	return scanlines;
+}
+
+auto write_golden(const std::string& path, const raytracer::Camera& camera, const std::vector<RGB>& pixels) {
+	raytracer::write_ppm(path, raytracer::ImageView{ pixels, size_t(camera.width), size_t(camera.height) });
+}
+
+auto check_image(std::string_view name, const raytracer::RenderResult& result, const raytracer::Camera& camera, const bool& is_exact, const bool& is_update, std::string_view golden_name = {}) -> bool {
+	const auto path = std::string(GOLDEN_DIR) + "/" + std::string(golden_name.empty() ? name : golden_name) + ".ppm";
+	std::cout << std::left << std::setw(26) << name << std::right << std::fixed << std::setprecision(1)
+		<< std::setw(9) << result.render_time.count() << "ms  ";
+
+	if (is_update) {
+		write_golden(path, camera, result.pixels);
+		std::cout << "updated " << path << "\n";
+		return true;
+	}
+	const auto golden = read_ppm(path);
+	if (!golden.has_value() || golden->width != camera.width || golden->height != camera.height) {
+		std::cout << "FAIL missing or mismatched golden " << path << "\n";
+		return false;
+	}
+	const auto rendered = Image{ camera.width, camera.height, result.pixels };
+	const auto is_identical = std::equal(rendered.pixels.begin(), rendered.pixels.end(), golden->pixels.begin(),
+		[](const RGB& a, const RGB& b) { return a.r == b.r && a.g == b.g && a.b == b.b; });
+	const auto image_psnr = psnr(rendered, *golden);
+	const auto image_ssim = ssim(rendered, *golden);
+	const auto is_pass = is_exact ? is_identical : (is_identical || (image_psnr >= MIN_PSNR && image_ssim >= MIN_SSIM));
+
+	std::cout << (is_pass ? "pass" : "FAIL") << (is_identical ? "  identical" : "")
+		<< "  psnr " << image_psnr << "dB  ssim " << std::setprecision(4) << image_ssim << "\n";
+	return is_pass;
+}
+
+int main(int argc, char* argv[])
+{
+	const auto has_flag = [&](std::string_view flag) { return std::any_of(argv + 1, argv + argc, [&](const char* arg) { return arg == flag; }); };
+	const auto is_exact = has_flag("--exact");
+	const auto is_update = has_flag("--update");
+	const auto camera = raytracer::Camera{ GOLDEN_SIZE, GOLDEN_SIZE, degrees_to_radians(90) };
+	auto is_all_pass = true;
+
+	for (const auto& reference : raytracer::scenes::REFERENCE_SCENES) {
+		const auto result = raytracer::render(camera, reference.make_scene());
+		is_all_pass &= check_image(reference.name, result, camera, is_exact, is_update);
+	}
+
+	raytracer::ProgressiveSettings settings;
+	settings.max_passes = 4;
+	settings.seed = 7;
+	const auto progressive = raytracer::render(camera, settings);
+	is_all_pass &= check_image("progressive", progressive, camera, is_exact, is_update);
+
+	// Material sorted shading reseeds every sample, so it must give the same images.
+	raytracer::RenderControl sorted;
+	sorted.sort_by_material = true;
+	const auto sorted_scene = raytracer::render(camera, raytracer::scenes::make_mirrors_and_glass(), sorted);
+	is_all_pass &= check_image("mirrors_and_glass_sorted", sorted_scene, camera, is_exact, false, "mirrors_and_glass");
+	// Sorted shading also evaluates procedural albedos in batches, which must match evaluating them one at a time.
+	const auto sorted_procedural = raytracer::render(camera, raytracer::scenes::make_procedural(), sorted);
+	is_all_pass &= check_image("procedural_sorted", sorted_procedural, camera, is_exact, false, "procedural");
+	const auto sorted_progressive = raytracer::render(camera, settings, sorted);
+	is_all_pass &= check_image("progressive_sorted", sorted_progressive, camera, is_exact, false, "progressive");
+
+	// Resuming from a checkpoint written after two passes must finish with the image of four passes in one go.
+	{
+		auto checkpointed = settings;
+		checkpointed.checkpoint_path = (std::filesystem::temp_directory_path() / "golden_progressive.rtck").string();
+		checkpointed.max_passes = 2;
+		std::filesystem::remove(checkpointed.checkpoint_path);
+		raytracer::render(camera, checkpointed);
+		const auto checkpoint = raytracer::read_checkpoint(checkpointed.checkpoint_path);
+		const auto has_checkpoint = checkpoint.has_value() && std::all_of(checkpoint->accumulator.sample_count.begin(),
+			checkpoint->accumulator.sample_count.end(), [](const uint32_t& count) { return count == 2; });
+		std::cout << std::left << std::setw(37) << "checkpoint written" << (has_checkpoint ? "pass" : "FAIL") << "\n";
+		is_all_pass &= has_checkpoint;
+		// The first pass previewed shows the render picked up after the two passes in the checkpoint.
+		size_t first_pass = 0;
+		checkpointed.max_passes = settings.max_passes;
+		checkpointed.resume = true;
+		checkpointed.preview_pass_interval = 1;
+		checkpointed.on_preview = [&](raytracer::PixelSpan, const size_t& pass) { first_pass = first_pass == 0 ? pass : first_pass; };
+		is_all_pass &= check_image("progressive_resumed", raytracer::render(camera, checkpointed), camera, is_exact, false, "progressive");
+		std::cout << std::left << std::setw(37) << "checkpoint resumed" << (first_pass == 3 ? "pass" : "FAIL") << "\n";
+		is_all_pass &= first_pass == 3;
+	}
+
+	// A checkpoint whose header claims more pixels than the file holds must be rejected before anything is allocated for them.
+	if (!is_update) {
+		const auto checkpoint_path = (std::filesystem::temp_directory_path() / "golden_corrupt.rtck").string();
+		raytracer::Checkpoint checkpoint{ 4, 4, 7, raytracer::Accumulator{ 16 } };
+		auto is_rejected = raytracer::write_checkpoint(checkpoint_path, checkpoint) && raytracer::read_checkpoint(checkpoint_path).has_value();
+		std::filesystem::resize_file(checkpoint_path, std::filesystem::file_size(checkpoint_path) - 1);
+		is_rejected &= !raytracer::read_checkpoint(checkpoint_path).has_value();
+		// Overwrites the width and height, which follow the magic and version.
+		is_rejected &= raytracer::write_checkpoint(checkpoint_path, checkpoint);
+		{
+			std::fstream file{ checkpoint_path, std::ios::binary | std::ios::in | std::ios::out };
+			const std::array<uint32_t, 2> size = { std::numeric_limits<uint32_t>::max(), std::numeric_limits<uint32_t>::max() };
+			file.seekp(8);
+			file.write(reinterpret_cast<const char*>(size.data()), sizeof(size));
+		}
+		is_rejected &= !raytracer::read_checkpoint(checkpoint_path).has_value();
+		std::cout << std::left << std::setw(37) << "corrupt checkpoint" << (is_rejected ? "pass" : "FAIL") << "\n";
+		is_all_pass &= is_rejected;
+	}
+
+	// A render cancelled or out of time before it starts finishes no tile and leaves the caller's pixels as they were.
+	// One cancelled after its first pass keeps that pass, which has to match a render of one pass.
+	if (!is_update) {
+		const auto is_untouched = [](const raytracer::RenderResult& result, const std::vector<RGB>& frame) {
+			return !result.is_complete && !result.tile_coverage.empty()
+				&& std::all_of(result.tile_coverage.begin(), result.tile_coverage.end(), [](const uint32_t& count) { return count == 0; })
+				&& std::all_of(frame.begin(), frame.end(), [](const RGB& pixel) { return pixel.r == 1 && pixel.g == 2 && pixel.b == 3; });
+		};
+		std::vector<RGB> frame(GOLDEN_SIZE * GOLDEN_SIZE, RGB{ 1, 2, 3 });
+		raytracer::CancellationToken cancelled;
+		cancelled.cancel();
+		raytracer::RenderControl stopped;
+		stopped.cancellation = &cancelled;
+		auto is_stopped = is_untouched(raytracer::render(camera, raytracer::make_default_scene(), std::span(frame), stopped), frame);
+		raytracer::RenderControl expired;
+		expired.deadline = std::chrono::steady_clock::now();
+		is_stopped &= is_untouched(raytracer::render(camera, raytracer::make_default_scene(), std::span(frame), expired), frame);
+
+		raytracer::CancellationToken after_first_pass;
+		raytracer::RenderControl cancellable;
+		cancellable.cancellation = &after_first_pass;
+		auto cancelled_settings = settings;
+		cancelled_settings.on_preview = [&](raytracer::PixelSpan, const size_t&) { after_first_pass.cancel(); };
+		const auto partial = raytracer::render(camera, cancelled_settings, cancellable);
+		auto one_pass = settings;
+		one_pass.max_passes = 1;
+		const auto reference = raytracer::render(camera, one_pass).pixels;
+		is_stopped &= !partial.is_complete && partial.passes == 1
+			&& std::all_of(partial.tile_coverage.begin(), partial.tile_coverage.end(), [](const uint32_t& count) { return count == 1; })
+			&& std::equal(partial.pixels.begin(), partial.pixels.end(), reference.begin(), reference.end(),
+				[](const RGB& a, const RGB& b) { return a.r == b.r && a.g == b.g && a.b == b.b; });
+		std::cout << std::left << std::setw(37) << "cancellation" << (is_stopped ? "pass" : "FAIL") << "\n";
+		is_all_pass &= is_stopped;
+	}
+
+	// Overlapping regions are split into tiles that cover their union once, and rendering them gives the golden's pixels
+	// there and leaves the rest of the frame alone. Empty regions and regions outside the frame are refused.
+	if (!is_update) {
+		const std::vector<raytracer::Tile> regions = { { 10, 20, 70, 50 }, { 40, 5, 100, 90 }, { 50, 30, 60, 40 } };
+		const auto is_in_region = [&](const size_t& x, const size_t& y) {
+			return std::any_of(regions.begin(), regions.end(), [&](const raytracer::Tile& region) {
+				return x >= region.x_begin && x < region.x_end && y >= region.y_begin && y < region.y_end;
+			});
+		};
+		std::vector<uint32_t> covered(GOLDEN_SIZE * GOLDEN_SIZE, 0);
+		for (const auto& tile : raytracer::make_tiles(camera, regions)) {
+			for (size_t y = tile.y_begin; y < tile.y_end; ++y) {
+				for (size_t x = tile.x_begin; x < tile.x_end; ++x) {
+					covered[y * GOLDEN_SIZE + x]++;
+				}
+			}
+		}
+		raytracer::RenderControl region_control;
+		region_control.regions = regions;
+		const auto region_render = raytracer::render(camera, region_control);
+		const auto golden = read_ppm(std::string(GOLDEN_DIR) + "/default.ppm");
+		auto is_covered = golden.has_value() && region_render.is_complete;
+		for (size_t y = 0; y < GOLDEN_SIZE && is_covered; ++y) {
+			for (size_t x = 0; x < GOLDEN_SIZE; ++x) {
+				const auto index = y * GOLDEN_SIZE + x;
+				const auto& pixel = region_render.pixels[index];
+				const auto& expected = is_in_region(x, y) ? golden->pixels[index] : RGB{ 0, 0, 0 };
+				is_covered &= covered[index] == (is_in_region(x, y) ? 1u : 0u);
+				is_covered &= !is_exact || (pixel.r == expected.r && pixel.g == expected.g && pixel.b == expected.b);
+			}
+		}
+		for (const auto& invalid : { raytracer::Tile{ 10, 10, 10, 20 }, raytracer::Tile{ 30, 20, 10, 40 },
+			raytracer::Tile{ 100, 0, GOLDEN_SIZE + 1, 10 }, raytracer::Tile{ 0, GOLDEN_SIZE, 10, GOLDEN_SIZE + 10 } }) {
+			is_covered &= !raytracer::is_valid_region(camera, invalid);
+		}
+		region_control.regions.push_back(raytracer::Tile{ 0, 0, 0, 0 });
+		std::vector<RGB> frame(GOLDEN_SIZE * GOLDEN_SIZE, RGB{ 1, 2, 3 });
+		is_covered &= !raytracer::render(camera, raytracer::make_default_scene(), std::span(frame), region_control).is_complete
+			&& std::all_of(frame.begin(), frame.end(), [](const RGB& pixel) { return pixel.r == 1 && pixel.g == 2 && pixel.b == 3; });
+		std::cout << std::left << std::setw(37) << "regions" << (is_covered ? "pass" : "FAIL") << "\n";
+		is_all_pass &= is_covered;
+	}
+
+	// A ray depth with no compiled kernel falls back to the default one, and a shallower kernel must trace fewer rays.
+	raytracer::RenderControl uncompiled;
+	uncompiled.ray_depth = 3;
+	const auto fallback = raytracer::render(camera, uncompiled);
+	is_all_pass &= check_image("default_kernel_fallback", fallback, camera, is_exact, false, "default");
+	if (!is_update) {
+		raytracer::RenderControl shallow;
+		shallow.ray_depth = 1;
+		shallow.samples_per_pixel = 1;
+		const auto shallow_result = raytracer::render(camera, shallow);
+		const auto is_dispatched = shallow_result.ray_counts.total() < fallback.ray_counts.total() && shallow_result.pixels.size() == fallback.pixels.size()
+			&& shallow_result.ray_counts.primary == GOLDEN_SIZE * GOLDEN_SIZE && fallback.ray_counts.primary == 2 * GOLDEN_SIZE * GOLDEN_SIZE;
+		std::cout << std::left << std::setw(37) << "kernel dispatch" << (is_dispatched ? "pass" : "FAIL") << "\n";
+		is_all_pass &= is_dispatched;
+	}
+
+#ifdef RAYTRACER_DISTRIBUTED
+	// Two workers forked from this process must render the local image, and once every worker has exited the coordinator renders the rest itself.
+	{
+		raytracer::distributed::CoordinatorSettings coordinator{ (std::filesystem::temp_directory_path() / "golden_coordinator.sock").string() };
+		const auto run_distributed = [&](const raytracer::Scene& scene) {
+			std::cout << std::flush;
+			std::vector<pid_t> workers;
+			for (int i = 0; i < 2; ++i) {
+				const auto pid = fork();
+				if (pid == 0) {
+					_exit(raytracer::distributed::run_worker(coordinator.socket_path) ? 0 : 1);
+				}
+				workers.push_back(pid);
+			}
+			const auto distributed = raytracer::distributed::run_coordinator(camera, scene, coordinator);
+			for (const auto& pid : workers) {
+				waitpid(pid, nullptr, 0);
+			}
+			return distributed;
+		};
+		is_all_pass &= check_image("distributed", run_distributed(raytracer::make_default_scene()), camera, is_exact, false, "default");
+		// Workers build the scene the coordinator describes, and the coordinator falls back to the scene it was given.
+		coordinator.scene.reference_scene = "mirrors_and_glass";
+		const auto mirrors_and_glass = raytracer::scenes::make_mirrors_and_glass();
+		is_all_pass &= check_image("distributed_scene", run_distributed(mirrors_and_glass), camera, is_exact, false, "mirrors_and_glass");
+		// A worker that can't start exits straight away, which leaves the coordinator with none.
+		coordinator.spawn_local_workers = 1;
+		coordinator.worker_executable = "/nonexistent/raytracer";
+		is_all_pass &= check_image("distributed_fallback", raytracer::distributed::run_coordinator(camera, mirrors_and_glass, coordinator),
+			camera, is_exact, false, "mirrors_and_glass");
+	}
+#endif
+
+	// A budget of a single tile per cache shard evicts constantly, which must not change the image.
+	const auto texture_path = (std::filesystem::temp_directory_path() / "golden_checker.ppm").string();
+	const auto texture_cache_directory = (std::filesystem::temp_directory_path() / "golden_texture_cache").string();
+	write_checker_texture(texture_path);
+	std::filesystem::remove_all(texture_cache_directory);
+	if (const auto textured = raytracer::scenes::make_textured(texture_path, std::make_shared<raytracer::TextureCache>(size_t(64) << 20, texture_cache_directory))) {
+		is_all_pass &= check_image("textured", raytracer::render(camera, *textured), camera, is_exact, is_update);
+		auto tiny_cache = raytracer::scenes::make_textured(texture_path, std::make_shared<raytracer::TextureCache>(0, texture_cache_directory));
+		is_all_pass &= check_image("textured_tiny_cache", raytracer::render(camera, *tiny_cache), camera, is_exact, false, "textured");
+		const auto stats = tiny_cache->textures->get_stats();
+		is_all_pass &= stats.evictions > 0 && stats.lookups >= stats.tile_loads && stats.tile_loads > 0;
+		// An image cut off part way must fail to convert without leaving its partly written file behind.
+		const auto truncated_path = (std::filesystem::temp_directory_path() / "golden_truncated.ppm").string();
+		const auto tiled_path = (std::filesystem::path(texture_cache_directory) / "golden_truncated.tiled").string();
+		std::filesystem::copy_file(texture_path, truncated_path, std::filesystem::copy_options::overwrite_existing);
+		std::filesystem::resize_file(truncated_path, std::filesystem::file_size(truncated_path) / 2);
+		const auto is_cleaned_up = !raytracer::make_tiled_texture(truncated_path, tiled_path)
+			&& !std::filesystem::exists(tiled_path) && !std::filesystem::exists(tiled_path + ".tmp");
+		std::cout << std::left << std::setw(37) << "truncated texture" << (is_cleaned_up ? "pass" : "FAIL") << "\n";
+		is_all_pass &= is_cleaned_up;
+	}
+	else {
+		std::cout << "FAIL could not load " << texture_path << "\n";
+		is_all_pass = false;
+	}
+
+	// The denoised render has a golden of its own, and has to be closer to a converged render than the noisy one.
+	raytracer::RenderControl denoised_control;
+	denoised_control.denoise = raytracer::DenoiseSettings{};
+	const auto denoised = raytracer::render(camera, denoised_control);
+	is_all_pass &= check_image("default_denoised", denoised, camera, is_exact, is_update);
+	if (!is_update) {
+		raytracer::ProgressiveSettings converged_settings;
+		converged_settings.max_passes = 64;
+		const auto converged = Image{ camera.width, camera.height, raytracer::render(camera, converged_settings).pixels };
+		const auto noisy_psnr = psnr(Image{ camera.width, camera.height, raytracer::render(camera).pixels }, converged);
+		const auto denoised_psnr = psnr(Image{ camera.width, camera.height, denoised.pixels }, converged);
+		const auto is_better = denoised_psnr > noisy_psnr + 3;
+		std::cout << std::left << std::setw(37) << "denoise improvement" << (is_better ? "pass" : "FAIL") << "  psnr against 64 passes "
+			<< std::setprecision(1) << noisy_psnr << "dB noisy, " << denoised_psnr << "dB denoised\n";
+		is_all_pass &= is_better;
+	}
+
+	// Writing AOVs must not change the image, sorted shading must write the same AOVs, and direct plus
+	// indirect light must add up to the image up to its rounding to whole 8-bit values.
+	raytracer::RenderControl aov_control;
+	for (size_t i = 0; i < raytracer::AOV_COUNT; ++i) {
+		aov_control.aovs = aov_control.aovs.with(raytracer::Aov(i));
+	}
+	const auto with_aovs = raytracer::render(camera, aov_control);
+	is_all_pass &= check_image("default_aovs", with_aovs, camera, is_exact, false, "default");
+	aov_control.sort_by_material = true;
+	const auto sorted_aovs = raytracer::render(camera, aov_control).aovs;
+	if (!is_update) {
+		auto is_consistent = sorted_aovs.planes == with_aovs.aovs.planes;
+		using raytracer::Aov;
+		for (size_t i = 0; i < with_aovs.pixels.size(); ++i) {
+			const auto& pixel = with_aovs.pixels[i];
+			for (const auto& [channel, value] : { std::pair{ 0, pixel.r }, std::pair{ 1, pixel.g }, std::pair{ 2, pixel.b } }) {
+				const auto light = with_aovs.aovs.plane(Aov::direct, channel)[i] + with_aovs.aovs.plane(Aov::indirect, channel)[i];
+				is_consistent &= std::abs(light - value / 255.0f) <= 1 / 255.0f;
+			}
+			const auto id = with_aovs.aovs.plane(Aov::object_id, 0)[i];
+			is_consistent &= (id == -1) == std::isinf(with_aovs.aovs.plane(Aov::depth, 0)[i]);
+		}
+		// Each compression must write, must make the file smaller than the one before it, and must decode
+		// back to the scanlines it was given, channels in name order.
+		const auto channels = with_aovs.aovs.get_channels();
+		std::vector<const raytracer::ImageChannel*> sorted;
+		for (const auto& channel : channels) {
+			sorted.push_back(&channel);
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b) { return a->name < b->name; });
+		std::vector<uint8_t> scanlines;
+		for (size_t y = 0; y < GOLDEN_SIZE; ++y) {
+			for (const auto* channel : sorted) {
+				const auto* row = reinterpret_cast<const uint8_t*>(channel->values.data() + y * GOLDEN_SIZE);
+				scanlines.insert(scanlines.end(), row, row + GOLDEN_SIZE * sizeof(float));
+			}
+		}
+		uintmax_t previous_size = std::numeric_limits<uintmax_t>::max();
+		for (const auto& compression : { raytracer::ExrCompression::none, raytracer::ExrCompression::rle, raytracer::ExrCompression::zip }) {
+			const auto exr_path = (std::filesystem::temp_directory_path() / "golden_aovs.exr").string();
+			is_consistent &= raytracer::write_exr(exr_path, GOLDEN_SIZE, GOLDEN_SIZE, channels, raytracer::ExrSettings{ compression });
+			const auto size = std::filesystem::file_size(exr_path);
+			is_consistent &= size < previous_size;
+			previous_size = size;
+			is_consistent &= read_exr_scanlines(exr_path, GOLDEN_SIZE, GOLDEN_SIZE, channels.size(), compression) == scanlines;
+		}
+		const auto pfm_path = (std::filesystem::temp_directory_path() / "golden_albedo.pfm").string();
+		is_consistent &= raytracer::write_pfm(pfm_path, GOLDEN_SIZE, GOLDEN_SIZE, std::span(channels).first(3));
+		is_consistent &= std::filesystem::file_size(pfm_path) > GOLDEN_SIZE * GOLDEN_SIZE * 3 * sizeof(float);
+		std::cout << std::left << std::setw(37) << "aov consistency" << (is_consistent ? "pass" : "FAIL") << "\n";
+		is_all_pass &= is_consistent;
+	}
+
+	// Solved in double, hits on a ground sphere of radius 10000 must land on it, in float they are off by up to a unit.
+	if constexpr (!std::is_same_v<Real, float>) {
+		const auto radius = 10000.0f;
+		const shapes::Sphere ground{ pt3{ 0, -radius - 0.2f, -1 }, radius };
+		Real max_error = 0;
+		for (int x = -50; x <= 50; ++x) {
+			for (int y = 1; y <= 50; ++y) {
+				const auto direction = vec3{ x * 0.06f, y * -0.02f, -1 };
+				if (const auto t = shapes::get_hit_t(ground, pt3{ 0, 0, 0 }, direction)) {
+					const auto hit = pt_from_ray(pt3{ 0, 0, 0 }, direction, *t);
+					max_error = std::max(max_error, std::abs(magnitude(vec_from_pts(hit, ground.position)) - ground.radius));
+				}
+			}
+		}
+		const auto is_on_surface = max_error < 1e-4;
+		std::cout << std::left << std::setw(37) << "large sphere hits" << (is_on_surface ? "pass" : "FAIL") << "  max distance from the surface "
+			<< std::scientific << std::setprecision(1) << max_error << std::fixed << "\n";
+		is_all_pass &= is_on_surface;
+	}
+
+	// Default settings must leave the image as it is, and 8-bit input must tonemap like the same colours in float.
+	{
+		const auto plain = raytracer::render(camera, raytracer::make_default_scene());
+		std::vector<RGB8> bytes(plain.pixels.size());
+		std::vector<RGBf> floats(plain.pixels.size());
+		raytracer::convert_pixels(std::span<const RGB>(plain.pixels), std::span<RGB8>(bytes));
+		raytracer::convert_pixels(std::span<const RGB>(plain.pixels), std::span<RGBf>(floats));
+		std::vector<RGB8> from_bytes(bytes.size());
+		std::vector<RGB8> from_floats(bytes.size());
+		const auto is_same = [](const std::vector<RGB8>& a, const std::vector<RGB8>& b) {
+			return std::equal(a.begin(), a.end(), b.begin(), [](const RGB8& p, const RGB8& q) { return p.r == q.r && p.g == q.g && p.b == q.b; });
+		};
+		raytracer::tonemap(raytracer::ImageView{ floats, GOLDEN_SIZE, GOLDEN_SIZE }, std::span(from_floats));
+		auto is_consistent = is_same(from_floats, bytes);
+		const raytracer::TonemapSettings settings{ 0.5f, raytracer::ToneCurve::aces, true, true };
+		raytracer::tonemap(raytracer::ImageView{ bytes, GOLDEN_SIZE, GOLDEN_SIZE }, std::span(from_bytes), settings);
+		raytracer::tonemap(raytracer::ImageView{ floats, GOLDEN_SIZE, GOLDEN_SIZE }, std::span(from_floats), settings);
+		is_consistent &= is_same(from_bytes, from_floats) && !is_same(from_bytes, bytes);
+		std::cout << std::left << std::setw(37) << "tonemap consistency" << (is_consistent ? "pass" : "FAIL") << "\n";
+		is_all_pass &= is_consistent;
+	}
+
+	// Every framebuffer format holds the 8-bit image exactly, so each must reproduce the default golden.
+	for (const auto& format : { raytracer::PixelFormat::rgb8, raytracer::PixelFormat::rgba8, raytracer::PixelFormat::rgb16,
+		raytracer::PixelFormat::half, raytracer::PixelFormat::float32 }) {
+		raytracer::visit_pixel_format(format, [&](const auto& pixel) {
+			using Pixel = std::decay_t<decltype(pixel)>;
+			std::vector<Pixel> frame(GOLDEN_SIZE * GOLDEN_SIZE);
+			auto result = raytracer::render(camera, raytracer::make_default_scene(), frame);
+			result.pixels.resize(frame.size());
+			raytracer::convert_pixels(std::span<const Pixel>(frame), std::span<RGB>(result.pixels));
+			const auto name = "default_" + std::string(raytracer::PixelTraits<Pixel>::name);
+			is_all_pass &= check_image(name, result, camera, is_exact, false, "default");
+		});
+	}
+
+	// Frames pushed through a slow writer come out complete and in order, a frame is never handed out while every
+	// buffer is still waiting to be written, and destroying the pipeline writes whatever is left.
+	{
+		constexpr size_t FRAME_COUNT = 8;
+		constexpr size_t BUFFER_COUNT = 2;
+		std::mutex written_mutex;
+		std::vector<std::pair<std::string, uint8_t>> written;
+		auto is_ordered = true;
+		{
+			raytracer::OutputPipeline<RGB8> pipeline(4, 2, BUFFER_COUNT, [&](const std::string& file_name, const raytracer::ImageView<RGB8>& image) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				std::lock_guard lock{ written_mutex };
+				written.emplace_back(file_name, image.row(1)[3].r);
+				return true;
+			});
+			for (size_t i = 0; i < FRAME_COUNT; ++i) {
+				const auto frame = pipeline.acquire();
+				{
+					std::lock_guard lock{ written_mutex };
+					is_ordered &= i - written.size() <= BUFFER_COUNT - 1 && frame.pixels.back().r == 0;
+				}
+				std::fill(frame.pixels.begin(), frame.pixels.end(), RGB8{ uint8_t(i + 1), 0, 0 });
+				pipeline.submit(frame, "frame_" + std::to_string(i));
+			}
+		}
+		is_ordered &= written.size() == FRAME_COUNT;
+		for (size_t i = 0; i < written.size(); ++i) {
+			is_ordered &= written[i] == std::pair{ "frame_" + std::to_string(i), uint8_t(i + 1) };
+		}
+		std::cout << std::left << std::setw(37) << "output pipeline" << (is_ordered ? "pass" : "FAIL") << "\n";
+		is_all_pass &= is_ordered;
+	}
+
+	// Float progressive renders resolve the mean itself, within one 8-bit step above the 8-bit render and not always on one.
+	{
+		std::vector<RGBf> frame(GOLDEN_SIZE * GOLDEN_SIZE);
+		raytracer::render(camera, raytracer::make_default_scene(), settings, frame);
+		auto is_within_step = true;
+		auto has_fraction = false;
+		for (size_t i = 0; i < frame.size(); ++i) {
+			const auto& eight_bit = progressive.pixels[i];
+			for (const auto& [value, step] : { std::pair{ frame[i].r, eight_bit.r }, std::pair{ frame[i].g, eight_bit.g }, std::pair{ frame[i].b, eight_bit.b } }) {
+				const auto scaled = value * 255;
+				is_within_step &= scaled >= step - 1e-3f && scaled < step + 1;
+				has_fraction |= std::abs(scaled - std::round(scaled)) > 1e-2f;
+			}
+		}
+		const auto is_precise = is_within_step && has_fraction;
+		std::cout << std::left << std::setw(37) << "float progressive precision" << (is_precise ? "pass" : "FAIL") << "\n";
+		is_all_pass &= is_precise;
+	}
+
+	return is_all_pass ? 0 : 1;
+}